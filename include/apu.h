@@ -28,11 +28,11 @@ void write_dmc_reg_1(uint8_t val); // $4011
 void write_dmc_reg_2(uint8_t val); // $4012
 void write_dmc_reg_3(uint8_t val); // $4013
 // IRQ line from DMC
-extern bool dmc_irq;
+extern EMU_STATE bool dmc_irq;
 
 void write_frame_counter(uint8_t val); // $4017
 // IRQ line from frame counter
-extern bool frame_irq;
+extern EMU_STATE bool frame_irq;
 
 // $4015
 uint8_t read_apu_status();
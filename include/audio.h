@@ -3,11 +3,17 @@
 void init_audio_for_rom();
 void deinit_audio_for_rom();
 
+// Set while running ahead (see run_ahead_frames). No audio is generated. Each
+// frame starts and ends at signal level zero (see set_audio_signal_level()),
+// so frames can be left out without glitches.
+extern EMU_STATE bool discard_audio;
+
 // Sets the instantaneous signal level
 void set_audio_signal_level(int16_t level);
 // Resamples and buffers the audio generated during one (video) frame
 void end_audio_frame();
 // Moves up to 'len' samples from the audio buffer to 'dst'. In case of
 // underflow, moves all remaining samples and zeroes the remainder of 'dst' (as
-// required by SDL2).
+// required by SDL2). Called from the SDL audio callback. Safe to call while the
+// emulation thread is running end_audio_frame(), without locking.
 void read_samples(int16_t *dst, size_t len);
@@ -0,0 +1,52 @@
+// Benchmark mode (--benchmark). Runs a ROM headless for a number of frames as
+// fast as possible, and prints the emulation speed along with how much time
+// went into each component as JSON. The ROM is run twice: once without timing
+// the components, which gives the speed, and once with, which gives the
+// breakdown.
+
+enum Bench_component {
+    BENCH_PPU,      // Running the PPU in sync_ppu(). Estimated by timing a sample of the calls.
+    BENCH_APU,      // tick_apu(). Estimated by timing a sample of the calls.
+    BENCH_AUDIO,    // end_audio_frame()
+    BENCH_SNAPSHOT, // Per-frame rewind snapshots (handle_rewind())
+    N_BENCH_COMPONENTS
+};
+
+// True while a benchmark is running
+extern EMU_STATE bool benchmarking;
+// True during the benchmark pass that times the components. The timing below
+// is only done then.
+extern EMU_STATE bool bench_timing;
+
+// Time spent in each component, in bench_clock() units
+extern EMU_STATE uint64_t bench_time[N_BENCH_COMPONENTS];
+// Number of PPU dots run
+extern EMU_STATE uint64_t bench_ppu_dots;
+
+// Cheap monotonic clock with an unspecified unit. Converted to seconds by
+// comparing against the wall-clock time of the whole run.
+inline uint64_t bench_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return 1000000000ull*ts.tv_sec + ts.tv_nsec;
+#endif
+}
+
+// Runs tick_apu(), timing every few calls if bench_timing is set. Timing every
+// call would mostly measure reading the clock.
+void timed_tick_apu();
+
+// Runs the PPU for 'ticks' ticks while benchmarking. Counts the dots, and
+// times every few calls if bench_timing is set. When the PPU runs in lockstep
+// with the CPU, this is called on every CPU cycle.
+void timed_run_ppu(unsigned ticks);
+
+// Called at the end of each frame while benchmarking. Takes a rewind snapshot,
+// which would otherwise only happen with a window (see handle_ui_keys()).
+void benchmark_end_of_frame();
+
+// Runs 'rom_filename' for 'n_frames' frames and prints the results
+void run_benchmark(char const *rom_filename, unsigned long n_frames);
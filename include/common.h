@@ -27,6 +27,16 @@
 
 extern char const *program_name; // argv[0]
 
+// Storage class for emulation state (CPU registers, PPU state, mapper
+// registers, etc.). In HEADLESS=1 builds each thread gets its own copy of the
+// state, which lets several consoles run in one process (see emulator.h).
+// Other builds run a single console and use plain globals.
+#ifdef HEADLESS
+#  define EMU_STATE __thread
+#else
+#  define EMU_STATE
+#endif
+
 //
 // General utility functions and macros
 //
@@ -103,7 +113,7 @@ T *alloc_array_init(size_t size, T const&val) {
 // Frees a pointer and sets it to null, making null equivalent to not
 // allocated, memory errors easier to debug, and the pointer safe to re-free
 template<typename T>
-void free_array_set_null(T *p) {
+void free_array_set_null(T *&p) {
     delete [] p;
     p = 0;
 }
@@ -147,8 +157,32 @@ void transfer_p(T *ptr, size_t len, uint8_t *&bufp) {
     bufp += len;
 }
 
+// Dirty page tracking. Large memory areas (RAM, WRAM, CIRAM, and CHR RAM) have
+// a flag per dirty_page_size bytes that is set when the page is written.
+// Rewind snapshots only copy the pages whose flags are set (see
+// save_states.cpp).
+size_t const dirty_page_size = 0x100;
+
+// Implemented in save_states.cpp. Loading clears the flags, except when
+// loading the run-ahead state (see load_run_ahead_state()).
+void save_tracked(uint8_t const *mem, uint8_t *dirty, size_t len, uint8_t *buf);
+void load_tracked(uint8_t *mem, uint8_t *dirty, size_t len, uint8_t const *buf);
+
+// Ditto for a memory area with dirty page tracking. 'dirty' holds the flags.
+template<bool calculating_size, bool is_save>
+void transfer_tracked(uint8_t *mem, uint8_t *dirty, size_t len, uint8_t *&bufp) {
+    if (!calculating_size) {
+        if (is_save)
+            save_tracked(mem, dirty, len, bufp);
+        else
+            load_tracked(mem, dirty, len, bufp);
+    }
+    bufp += len;
+}
+
 #define TRANSFER(x) transfer<calculating_size, is_save>(x, buf);
 #define TRANSFER_P(x, len) transfer_p<calculating_size, is_save>(x, len, buf);
+#define TRANSFER_TRACKED(x, dirty, len) transfer_tracked<calculating_size, is_save>(x, dirty, len, buf);
 
 //
 // Error reporting
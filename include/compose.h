@@ -0,0 +1,20 @@
+// Background/sprite pixel composition for whole runs of pixels. Used by the
+// scanline-batched renderer in ppu.cpp. Has SSE2 and AVX2 implementations,
+// picked at run time, and a plain C++ fallback.
+
+// Bits in the sprite plane passed to compose_pixels(). The low five bits hold
+// the palette index (0x11-0x1F) of the sprite pixel, or 0 if it is
+// transparent.
+uint8_t const SPR_BEHIND_BG = 0x20; // Sprite has background priority
+uint8_t const SPR_ZERO      = 0x40; // Pixel comes from sprite zero
+
+// Picks the implementation to use based on what the CPU supports
+void init_compose();
+
+// Produces 'n' pixels from the background plane 'bg' (palette index 0-15 per
+// pixel, 0 if transparent) and the sprite plane 'spr' (see above), writing the
+// palette indices through the 32-entry color table 'colors' into 'out'.
+// Returns true if a sprite zero pixel overlaps an opaque background pixel
+// (sprite zero hit).
+extern bool (*compose_pixels)(uint8_t const *bg, uint8_t const *spr,
+                              uint32_t const *colors, uint32_t *out, unsigned n);
@@ -3,23 +3,48 @@
 // http://wiki.nesdev.com/w/index.php/CPU
 
 #ifdef ENABLE_CORRUPTION
-extern unsigned int corrupt_chance;
+extern EMU_STATE unsigned int corrupt_chance;
 #endif
 
 // Current CPU read/write state. Needed to get the timing for APU DMC sample
 // loading right (tested by the sprdma_and_dmc_dma tests).
-extern bool cpu_is_reading;
+extern EMU_STATE bool cpu_is_reading;
 
 // Last value put on the CPU data bus. Used to implement open bus reads.
-extern uint8_t cpu_data_bus;
+extern EMU_STATE uint8_t cpu_data_bus;
 
 // Offset in CPU cycles within the current frame. Used for audio generation.
-extern unsigned frame_offset;
+extern EMU_STATE unsigned frame_offset;
+
+// Number of instructions executed since the last cold boot. Used to measure
+// emulation speed.
+extern EMU_STATE unsigned long long instructions_executed;
+
+// Number of frames of the game's input lag to hide by running ahead
+// (--run-ahead). At the end of each real frame, which isn't shown, the state is
+// saved, that many frames are run with the same input and without audio, and
+// the last one is shown. The state is then loaded back, and input is read for
+// the next real frame. 0 disables running ahead.
+extern EMU_STATE unsigned run_ahead_frames;
 
 // Runs the PPU and APU for one CPU cycle. Has external linkage so we can use
 // it while the CPU is halted during DMA.
 void tick();
 
+// The PPU runs behind the CPU and is only brought up to date when needed.
+// This runs it up to the current CPU cycle. Call it before accessing PPU state
+// from outside the CPU core's memory accessors, and after changing the PPU's
+// position within the frame (e.g. by loading a state).
+void sync_ppu();
+
+// Maps 'len' bytes of memory at 'mem' into the CPU address space at 'addr'.
+// Both 'addr' and 'len' must be multiples of 256. Reads in the range then go
+// straight to 'mem', as do writes if 'dirty' is non-null (writes are otherwise
+// ignored, apart from being seen by the mapper). 'dirty' holds the dirty page
+// flags for 'mem' (see dirty_page_size). A null 'mem' unmaps the range, making
+// reads return open bus.
+void map_cpu_mem(uint16_t addr, unsigned len, uint8_t *mem, uint8_t *dirty);
+
 // Also used outside the CPU core to load DMC samples - hence the external
 // linkage
 uint8_t read_mem(uint16_t addr);
@@ -46,24 +71,29 @@ void frame_completed();
 void soft_reset();
 // Signaled if emulation should end
 void end_emulation();
+// Signaled when the debugger is opened. Instructions then go through
+// dbg_log_instruction() until debugger_active() returns false.
+void debugger_opened();
 
 template<bool calculating_size, bool is_save>
 void transfer_cpu_state(uint8_t *&buf);
 
 // Debugging
 
-extern uint8_t ram[0x800];
-extern uint16_t pc;
-extern uint8_t a, s, x, y;
+extern EMU_STATE uint8_t ram[0x800];
+// Dirty page flags for 'ram'
+extern EMU_STATE uint8_t ram_dirty[0x800/dirty_page_size];
+extern EMU_STATE uint16_t pc;
+extern EMU_STATE uint8_t a, s, x, y;
 
-extern unsigned zn;
+extern EMU_STATE unsigned zn;
 
-extern bool carry;
-extern bool irq_disable;
-extern bool decimal;
-extern bool overflow;
+extern EMU_STATE bool carry;
+extern EMU_STATE bool irq_disable;
+extern EMU_STATE bool decimal;
+extern EMU_STATE bool overflow;
 
-extern uint8_t *wram_6000_page;
+extern EMU_STATE uint8_t *wram_6000_page;
 
-extern bool pending_irq;
-extern bool pending_nmi;
+extern EMU_STATE bool pending_irq;
+extern EMU_STATE bool pending_nmi;
@@ -6,4 +6,9 @@ int set_debugger_vis(bool vis);
 
 //returns 1 if execution may resume and 0 otherwise.
 int dbg_log_instruction(void);
+
+// Returns true if dbg_log_instruction() needs to be called before each
+// instruction: the debugger is visible, breakpoints are set, or emulation is
+// paused
+bool debugger_active(void);
 #endif
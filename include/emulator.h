@@ -0,0 +1,49 @@
+// Emulator instances for running several consoles in one process. Only
+// available in HEADLESS=1 builds.
+//
+// Each instance runs on a thread of its own. Since all emulation state is
+// thread-local in HEADLESS=1 builds (see EMU_STATE in common.h), instances are
+// fully independent of each other. init_apu() and init_mappers() must have
+// been called before any instance is started.
+
+#include <pthread.h>
+
+class Emulator {
+public:
+    // Prepares to run 'rom_filename' for 'n_frames' frames. 'rom_filename'
+    // must stay valid until wait() returns.
+    Emulator(char const *rom_filename, unsigned long n_frames);
+    ~Emulator();
+
+    // Loads the ROM and starts emulation on a new thread
+    void start();
+
+    // Waits for emulation to finish
+    void wait();
+
+    // Results. Valid after wait() has returned.
+
+    char const *rom() const { return rom_filename; }
+    unsigned long frames_run() const { return n_frames_run; }
+    unsigned long long audio_samples() const { return n_audio_samples; }
+    unsigned long long instructions() const { return n_instructions; }
+    // CPU time in seconds spent by the emulation thread
+    double cpu_time() const { return cpu_seconds; }
+    // Copy of the last completed frame (NES_PPU_W*NES_PPU_H ARGB pixels)
+    uint32_t const *last_frame() const { return frame; }
+
+private:
+    static void *emulation_thread(void *emulator);
+
+    char const *const rom_filename;
+    unsigned long const n_frames;
+
+    pthread_t thread;
+    bool started;
+
+    unsigned long n_frames_run;
+    unsigned long long n_audio_samples;
+    unsigned long long n_instructions;
+    double cpu_seconds;
+    uint32_t *frame;
+};
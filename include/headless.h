@@ -0,0 +1,50 @@
+// Headless operation. The emulator runs as fast as it can without opening a
+// window or an audio device. Frames are kept in memory and audio samples are
+// handed to a sink instead of being played back. Useful for automated testing
+// and batch processing.
+
+#ifdef HEADLESS
+// Builds made with HEADLESS=1 have no SDL dependency and are always headless
+bool const headless = true;
+#else
+// Set by the --headless command-line option
+extern bool headless;
+#endif
+
+// Number of frames to run before ending emulation. 0 means no limit.
+extern EMU_STATE unsigned long headless_frame_limit;
+
+// Number of frames completed so far
+extern EMU_STATE unsigned long headless_frames_run;
+
+// Number of audio samples received by headless_audio_samples() so far
+extern EMU_STATE unsigned long long headless_audio_samples_received;
+
+// Called at the end of each frame in headless mode. Ends emulation once
+// headless_frame_limit frames have been run.
+void headless_end_of_frame();
+
+// Returns true if the pixels of the next frame are looked at in headless mode:
+// if it's hashed (see start_frame_hashes()) or could be the last frame of the
+// run, which is kept around when the run ends. Called after
+// headless_end_of_frame().
+bool headless_video_needed();
+
+// Receives the resampled audio for each frame in headless mode
+void headless_audio_samples(int16_t const *samples, size_t len);
+
+// Writes hashes of the video and audio output to 'filename' during a headless
+// run, for checking that changes to the emulator don't change its output. A
+// line with the frame number, the MD5 of the frame, and the MD5 of the audio
+// since the previous line is written every 'interval' frames, and after the
+// last frame. Exits on errors.
+void start_frame_hashes(char const *filename, unsigned interval);
+// Writes the final line and closes the file, if hashes are being written
+void end_frame_hashes();
+
+// Returns the CPU time in seconds used by the calling thread. Used to measure
+// emulation speed.
+double headless_cpu_time();
+
+// Prints a summary of the headless run to stdout
+void report_headless_run();
@@ -13,7 +13,8 @@ extern struct Mapper_fns {
     void    (*write_nt)(uint8_t val, uint16_t addr);
 
     // Called each PPU tick. For mappers that snoop on PPU activity (the VRAM
-    // address bus).
+    // address bus). Null for other mappers, which lets the PPU run behind the
+    // CPU (see sync_ppu()).
     void    (*ppu_tick_callback)();
 
     // Saving and loading of mapper-specific state
@@ -46,7 +47,28 @@ void set_prg_32k_bank(unsigned bank);
 void set_prg_16k_bank(unsigned n, int bank, bool is_ram = false);
 void set_prg_8k_bank (unsigned n, int bank, bool is_ram = false);
 
-extern uint8_t *chr_pages[8];
+extern EMU_STATE uint8_t *chr_pages[8];
+
+// Pre-decoded CHR, kept in sync with chr_pages. Each row of eight pixels is
+// stored as a uint64_t with one byte per pixel (0-3), leftmost pixel in the
+// lowest byte. decoded_chr_pages[n] holds the 64*8 rows of chr_pages[n], with
+// row r of tile t at index 8*t + r.
+extern EMU_STATE uint64_t const *decoded_chr_pages[8];
+
+// Decodes a row from its low and high pattern bytes
+uint64_t decode_chr_row(uint8_t low, uint8_t high);
+
+// Allocates and fills the decoded CHR for the loaded ROM. Needs to be called
+// before the mapper maps any CHR.
+void init_decoded_chr();
+void deinit_decoded_chr();
+
+// Updates the decoded row containing 'chr_byte' (a pointer into CHR) after it
+// has been written. For CHR-RAM.
+void redecode_chr_byte(uint8_t const *chr_byte);
+
+// Redecodes all of CHR, e.g. after CHR-RAM has been loaded from a save state
+void decode_chr();
 
 void set_chr_8k_bank(unsigned bank);
 void set_chr_4k_bank(unsigned n, unsigned bank);
@@ -55,12 +77,16 @@ void set_chr_1k_bank(unsigned n, unsigned bank);
 
 // 8 KB page mapped at $6000-$7FFF. Used for extra work RAM (WRAM) and/or
 // saving (SRAM). MMC5 can remap this.
-extern uint8_t *wram_6000_page;
+extern EMU_STATE uint8_t *wram_6000_page;
 
 void set_wram_6000_bank(unsigned bank);
 
+// Returns the dirty page flags for the part of WRAM starting at 'p', or null if
+// 'p' is null
+uint8_t *wram_dirty_flags(uint8_t const *p);
+
 // Updating this will require updating mirroring_to_str as well
-extern enum Mirroring {
+extern EMU_STATE enum Mirroring {
     HORIZONTAL      = 0,
     VERTICAL        = 1,
     ONE_SCREEN_LOW  = 2,
@@ -0,0 +1,46 @@
+// Frame time and latency metrics (--metrics <file>). Per-frame measurements
+// are collected into histograms with fixed buckets, and the histograms and
+// counters for each interval are written out as one line of JSON at the end
+// of it. Nothing is measured unless metrics are enabled.
+//
+// The histograms and counters are updated from the emulation thread, the SDL
+// thread, and the audio callback, so all accesses are atomic.
+
+enum Metric {
+    METRIC_EMULATION, // Time spent emulating each frame, including frames run ahead, in microseconds
+    METRIC_SLEEP,     // Time spent waiting for the end of each frame, in microseconds
+    METRIC_PRESENT,   // Time taken by draw_actual_frame() for each shown frame, in microseconds
+    METRIC_AUDIO_FILL, // Audio ring buffer fill level at the end of each frame, in percent
+    N_METRICS
+};
+
+enum Counter {
+    COUNTER_DROPPED_FRAMES,   // Frames overwritten before the SDL thread got to them
+    COUNTER_AUDIO_UNDERFLOWS, // Audio callbacks that ran out of samples
+    COUNTER_AUDIO_OVERFLOWS,  // Audio frames that didn't fit in the ring buffer
+    N_COUNTERS
+};
+
+extern bool metrics_enabled;
+
+// Starts collecting metrics, writing them to 'filename' ("-" for stdout)
+// every 'interval' seconds
+void start_metrics(char const *filename, unsigned interval);
+// Writes the metrics for the last (partial) interval and closes the file
+void end_metrics();
+
+// Adds a measurement to the histogram for 'metric'
+void record_metric(Metric metric, unsigned value);
+// Increments 'counter'
+void count_metric(Counter counter);
+
+// Called with the time spent sleeping while pacing frames, in nanoseconds.
+// Adds it to METRIC_SLEEP and excludes it from METRIC_EMULATION.
+void record_sleep_time(int64_t nanos);
+
+// Called at the end of each frame from the emulation thread. Records
+// METRIC_EMULATION and writes the metrics at the end of each interval.
+void metrics_end_of_frame();
+
+// Current time in nanoseconds, for timing what's measured
+int64_t metrics_clock();
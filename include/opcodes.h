@@ -86,3 +86,39 @@ enum {
   KI0 = 0x02, KI1 = 0x12, KI2 = 0x22, KI3 = 0x32, KI4 = 0x42, KI5 = 0x52,
   KI6 = 0x62, KI7 = 0x72, KI8 = 0x92, KI9 = 0xB2, K10 = 0xD2, K11 = 0xF2
 };
+
+// Invokes X(name) for each opcode above, in order of opcode value. Used to
+// build the dispatch table for threaded dispatch in cpu.cpp.
+#define FOR_EACH_OPCODE(X)                                                                                 \
+  /* 00 */ X(BRK) X(ORA_IND_X) X(KI0) X(SLO_IND_X) X(NO0_ZERO) X(ORA_ZERO) X(ASL_ZERO) X(SLO_ZERO)         \
+  /* 08 */ X(PHP) X(ORA_IMM) X(ASL_ACC) X(AN0_IMM) X(NOP_ABS) X(ORA_ABS) X(ASL_ABS) X(SLO_ABS)             \
+  /* 10 */ X(BPL) X(ORA_IND_Y) X(KI1) X(SLO_IND_Y) X(NO0_ZERO_X) X(ORA_ZERO_X) X(ASL_ZERO_X) X(SLO_ZERO_X) \
+  /* 18 */ X(CLC) X(ORA_ABS_Y) X(NO0) X(SLO_ABS_Y) X(NO0_ABS_X) X(ORA_ABS_X) X(ASL_ABS_X) X(SLO_ABS_X)     \
+  /* 20 */ X(JSR_ABS) X(AND_IND_X) X(KI2) X(RLA_IND_X) X(BIT_ZERO) X(AND_ZERO) X(ROL_ZERO) X(RLA_ZERO)     \
+  /* 28 */ X(PLP) X(AND_IMM) X(ROL_ACC) X(AN1_IMM) X(BIT_ABS) X(AND_ABS) X(ROL_ABS) X(RLA_ABS)             \
+  /* 30 */ X(BMI) X(AND_IND_Y) X(KI3) X(RLA_IND_Y) X(NO1_ZERO_X) X(AND_ZERO_X) X(ROL_ZERO_X) X(RLA_ZERO_X) \
+  /* 38 */ X(SEC) X(AND_ABS_Y) X(NO1) X(RLA_ABS_Y) X(NO1_ABS_X) X(AND_ABS_X) X(ROL_ABS_X) X(RLA_ABS_X)     \
+  /* 40 */ X(RTI) X(EOR_IND_X) X(KI4) X(SRE_IND_X) X(NO1_ZERO) X(EOR_ZERO) X(LSR_ZERO) X(SRE_ZERO)         \
+  /* 48 */ X(PHA) X(EOR_IMM) X(LSR_ACC) X(ALR_IMM) X(JMP_ABS) X(EOR_ABS) X(LSR_ABS) X(SRE_ABS)             \
+  /* 50 */ X(BVC) X(EOR_IND_Y) X(KI5) X(SRE_IND_Y) X(NO2_ZERO_X) X(EOR_ZERO_X) X(LSR_ZERO_X) X(SRE_ZERO_X) \
+  /* 58 */ X(CLI) X(EOR_ABS_Y) X(NO2) X(SRE_ABS_Y) X(NO2_ABS_X) X(EOR_ABS_X) X(LSR_ABS_X) X(SRE_ABS_X)     \
+  /* 60 */ X(RTS) X(ADC_IND_X) X(KI6) X(RRA_IND_X) X(NO2_ZERO) X(ADC_ZERO) X(ROR_ZERO) X(RRA_ZERO)         \
+  /* 68 */ X(PLA) X(ADC_IMM) X(ROR_ACC) X(ARR_IMM) X(JMP_IND) X(ADC_ABS) X(ROR_ABS) X(RRA_ABS)             \
+  /* 70 */ X(BVS) X(ADC_IND_Y) X(KI7) X(RRA_IND_Y) X(NO3_ZERO_X) X(ADC_ZERO_X) X(ROR_ZERO_X) X(RRA_ZERO_X) \
+  /* 78 */ X(SEI) X(ADC_ABS_Y) X(NO3) X(RRA_ABS_Y) X(NO3_ABS_X) X(ADC_ABS_X) X(ROR_ABS_X) X(RRA_ABS_X)     \
+  /* 80 */ X(NO0_IMM) X(STA_IND_X) X(NO1_IMM) X(SAX_IND_X) X(STY_ZERO) X(STA_ZERO) X(STX_ZERO) X(SAX_ZERO) \
+  /* 88 */ X(DEY) X(NO2_IMM) X(TXA) X(XAA_IMM) X(STY_ABS) X(STA_ABS) X(STX_ABS) X(SAX_ABS)                 \
+  /* 90 */ X(BCC) X(STA_IND_Y) X(KI8) X(AXA_IND_Y) X(STY_ZERO_X) X(STA_ZERO_X) X(STX_ZERO_Y) X(SAX_ZERO_Y) \
+  /* 98 */ X(TYA) X(STA_ABS_Y) X(TXS) X(TAS_ABS_Y) X(SAY_ABS_X) X(STA_ABS_X) X(XAS_ABS_Y) X(AXA_ABS_Y)     \
+  /* A0 */ X(LDY_IMM) X(LDA_IND_X) X(LDX_IMM) X(LAX_IND_X) X(LDY_ZERO) X(LDA_ZERO) X(LDX_ZERO) X(LAX_ZERO) \
+  /* A8 */ X(TAY) X(LDA_IMM) X(TAX) X(ATX_IMM) X(LDY_ABS) X(LDA_ABS) X(LDX_ABS) X(LAX_ABS)                 \
+  /* B0 */ X(BCS) X(LDA_IND_Y) X(KI9) X(LAX_IND_Y) X(LDY_ZERO_X) X(LDA_ZERO_X) X(LDX_ZERO_Y) X(LAX_ZERO_Y) \
+  /* B8 */ X(CLV) X(LDA_ABS_Y) X(TSX) X(LAS_ABS_Y) X(LDY_ABS_X) X(LDA_ABS_X) X(LDX_ABS_Y) X(LAX_ABS_Y)     \
+  /* C0 */ X(CPY_IMM) X(CMP_IND_X) X(NO3_IMM) X(DCP_IND_X) X(CPY_ZERO) X(CMP_ZERO) X(DEC_ZERO) X(DCP_ZERO) \
+  /* C8 */ X(INY) X(CMP_IMM) X(DEX) X(AXS_IMM) X(CPY_ABS) X(CMP_ABS) X(DEC_ABS) X(DCP_ABS)                 \
+  /* D0 */ X(BNE) X(CMP_IND_Y) X(K10) X(DCP_IND_Y) X(NO4_ZERO_X) X(CMP_ZERO_X) X(DEC_ZERO_X) X(DCP_ZERO_X) \
+  /* D8 */ X(CLD) X(CMP_ABS_Y) X(NO4) X(DCP_ABS_Y) X(NO4_ABS_X) X(CMP_ABS_X) X(DEC_ABS_X) X(DCP_ABS_X)     \
+  /* E0 */ X(CPX_IMM) X(SBC_IND_X) X(NO4_IMM) X(ISC_IND_X) X(CPX_ZERO) X(SBC_ZERO) X(INC_ZERO) X(ISC_ZERO) \
+  /* E8 */ X(INX) X(SBC_IMM) X(NOP) X(SB2_IMM) X(CPX_ABS) X(SBC_ABS) X(INC_ABS) X(ISC_ABS)                 \
+  /* F0 */ X(BEQ) X(SBC_IND_Y) X(K11) X(ISC_IND_Y) X(NO5_ZERO_X) X(SBC_ZERO_X) X(INC_ZERO_X) X(ISC_ZERO_X) \
+  /* F8 */ X(SED) X(SBC_ABS_Y) X(NO5) X(ISC_ABS_Y) X(NO5_ABS_X) X(SBC_ABS_X) X(INC_ABS_X) X(ISC_ABS_X)
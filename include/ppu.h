@@ -8,30 +8,45 @@
 
 // Nametable memory of variable size, initialized when loading the ROM. 2 KB is
 // built in, and the cart can provide an extra 2 KB (though this is rare).
-extern uint8_t *ciram;
+extern EMU_STATE uint8_t *ciram;
+// Dirty page flags for 'ciram'
+extern EMU_STATE uint8_t ciram_dirty[0x1000/dirty_page_size];
 
 // The number of the last line in the frame, at the end of the VBlank interval.
 // Differs between PAL and NTSC.
-extern unsigned prerender_line;
+extern EMU_STATE unsigned prerender_line;
 
 // Optimization - always equals show_bg || show_sprites
-extern bool rendering_enabled;
+extern EMU_STATE bool rendering_enabled;
+
+// Set for frames whose pixels won't be shown or otherwise looked at. The PPU
+// then skips palette lookups and frame buffer writes, but still does
+// everything that's visible to the CPU or the mapper, like fetches, sprite
+// evaluation, and sprite zero hit detection. Only changed between frames.
+extern EMU_STATE bool ppu_no_video;
 
 // PPU cycles run so far. Used as a general-purpose timestamp.
-extern uint64_t ppu_cycle;
+extern EMU_STATE uint64_t ppu_cycle;
 
 // Current position within the frame
-extern unsigned dot, scanline;
+extern EMU_STATE unsigned dot, scanline;
 
 // VRAM address currently being output. Some mappers (e.g., MMC3) snoop on
 // this.
-extern unsigned ppu_addr_bus;
+extern EMU_STATE unsigned ppu_addr_bus;
 
 void init_ppu_for_rom();
 
-// These use different timings corresponding to the TV standard
-void tick_ntsc_ppu();
-void tick_pal_ppu();
+// Runs the PPU for 'n_ticks' dots. These use different timings
+// corresponding to the TV standard.
+void run_ntsc_ppu(unsigned n_ticks);
+void run_pal_ppu(unsigned n_ticks);
+
+// Returns a lower bound on the number of dots until the PPU next does
+// something that is visible outside of it without being accessed: signaling
+// frame completion or asserting NMI. Returns 0 if the mapper snoops on the
+// PPU, in which case it must run in lockstep with the CPU. See sync_ppu().
+unsigned ppu_ticks_till_event();
 
 // n = 0...7 corresponds to $2000-$2007
 uint8_t read_ppu_reg(unsigned n);
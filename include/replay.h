@@ -0,0 +1,29 @@
+// Recording and playback of controller input logs
+//
+// Logs use a text format modeled on FCEUX's .fm2 files: a few "key value"
+// header lines followed by one line per frame,
+//
+//   |<commands>|RLDUTSBA|RLDUTSBA||
+//
+// where <commands> is 1 if reset is held and 0 otherwise, and each button
+// field is for one controller port, with '.' for released buttons. Playback
+// gives the same input on the same frames, so that a run can be reproduced
+// exactly. Loading states and rewinding aren't logged, and make playback
+// diverge.
+
+// Starts recording input to 'filename' or playing it back from it. Called
+// before the console is powered on. Exits on errors.
+void start_input_recording(char const *filename);
+void start_input_playback(char const *filename);
+
+// Finishes writing the log being recorded, if any, and closes the log file
+void end_input_replay();
+
+enum Replay_mode { REPLAY_NONE, REPLAY_RECORD, REPLAY_PLAY };
+extern EMU_STATE Replay_mode replay_mode;
+
+// Called by calc_controller_state() once per frame if replay_mode isn't
+// REPLAY_NONE. 'buttons' holds the button states of the two controllers in
+// the format returned by get_button_states(). When recording, the input is
+// appended to the log. When playing back, it is replaced by the logged input.
+void replay_frame(uint8_t buttons[2], bool &reset);
@@ -1,29 +1,37 @@
 // Loading and unloading of ROM files
 
 // Points to the start of the PRG data within the ROM image
-extern uint8_t *prg_base;
-extern unsigned prg_16k_banks;
+extern EMU_STATE uint8_t *prg_base;
+extern EMU_STATE unsigned prg_16k_banks;
 
 // Points to the start of the CHR data within the ROM image, or to a
 // dynamically allocated buffer if the cart uses RAM for CHR
-extern uint8_t *chr_base;
-extern unsigned chr_8k_banks;
-extern bool chr_is_ram;
+extern EMU_STATE uint8_t *chr_base;
+extern EMU_STATE unsigned chr_8k_banks;
+extern EMU_STATE bool chr_is_ram;
+// Dirty page flags for CHR RAM. Null if CHR is ROM.
+extern EMU_STATE uint8_t *chr_dirty;
 
 // Points to a dynamically allocated buffer for SRAM/WRAM. We usually have to
 // assume the cart has SRAM/WRAM due to iNES ickiness.
-extern uint8_t *wram_base;
-extern unsigned wram_8k_banks;
+extern EMU_STATE uint8_t *wram_base;
+extern EMU_STATE unsigned wram_8k_banks;
+// Dirty page flags for WRAM
+extern EMU_STATE uint8_t *wram_dirty;
 
 // True if this is a PAL ROM
-extern bool is_pal;
+extern EMU_STATE bool is_pal;
 
 // If true, the mapper has bus conflicts and does not shut off ROM output for
 // writes to the $8000+ range. This results in an AND between the written value
 // and the value in ROM. Cybernoid depends on this being emulated.
-extern bool has_bus_conflicts;
+extern EMU_STATE bool has_bus_conflicts;
 
-extern Mapper_fns mapper_fns;
+extern EMU_STATE Mapper_fns mapper_fns;
+
+// MD5 digest of the PRG ROM. Used to detect ROMs that need special handling,
+// and to check that save state files belong to the loaded ROM.
+extern EMU_STATE uint8_t rom_md5[16];
 
 // Loads a ROM file. If 'print_info' is true, information about the cart is
 // printed to stdout.
@@ -1,28 +1,70 @@
 // Save state and rewinding implementation
 
-void init_save_states_for_rom();
+// 'rom_filename' is used to derive default_state_filename(). If 'print_info' is
+// true, the state size is printed.
+void init_save_states_for_rom(char const *rom_filename, bool print_info);
 void deinit_save_states_for_rom();
 
 // Plain old save state. Not related to rewinding.
 void save_state();
 void load_state();
 
-#ifdef INCLUDE_REWIND
+// Keeps the state of the real frame in a separate buffer while running ahead
+// (see run_ahead_frames). Loading it back doesn't affect rewinding, but makes
+// the next rewind snapshot copy the whole state.
+void save_run_ahead_state();
+void load_run_ahead_state();
+
+// Saves the state to a file, or loads it from one. Files are tagged with a
+// hash of the ROM and can't be loaded with other ROMs. On errors, a message
+// is printed and false is returned. A failed load leaves the state untouched.
+bool save_state_to_file(char const *filename);
+bool load_state_from_file(char const *filename);
+
+// Saves the state to a file in the background. Only copying the state happens
+// on the calling thread. Returns false without doing anything if too many
+// earlier writes are still in progress. Errors are printed. 'filename' must be
+// default_state_filename() or the autosave file, which stay around while the
+// ROM is loaded.
+bool queue_state_file_write(char const *filename);
+// Waits for queued writes to finish. Call before writing a state file
+// synchronously, as it might be the same file.
+void finish_state_file_writes();
+
+// The ROM filename with ".state" appended
+char const *default_state_filename();
+
+// Saves the state to the ROM filename with ".autosave.state" appended every
+// 'seconds' seconds of emulated time, using queue_state_file_write(). 0
+// disables autosaving.
+void set_autosave_interval(unsigned seconds);
+// Called once per frame
+void handle_autosave();
+
+// Sets a save state file to load once the console has been powered on. Loading
+// it earlier would be pointless, since powering on resets the state.
+void set_startup_state_file(char const *filename);
+// Called by run() after powering on. Exits if the file can't be loaded.
+void load_startup_state();
+
 // Called once per frame to implementing rewinding. If 'do_rewind' is true, we
 // should rewind.
 void handle_rewind(bool do_rewind);
-#endif
+
+// Memory budget for rewinding, in MiB. The number of frames that can be
+// rewound depends on how well the states compress. 0 disables rewinding.
+// Memory is allocated as needed while running, and lowering the budget drops
+// the oldest frames that no longer fit.
+unsigned const default_rewind_budget_mb = 64;
+void set_rewind_budget_mb(unsigned mb);
+unsigned rewind_budget_mb();
 
 // Returns the length of the current frame in CPU ticks. Assumes we are
 // currently rewinding. (There'd be no way to know the length if we hadn't
 // already run the frame.)
 unsigned get_frame_len();
 
-#ifdef INCLUDE_REWIND
 // True if the current frame should appear to run in reverse (e.g., w.r.t.
 // audio)
-extern bool is_backwards_frame;
-#else
-#define is_backwards_frame 0
-#endif
+extern EMU_STATE bool is_backwards_frame;
 
@@ -1,7 +1,11 @@
 // vi:sw=2
-// Video, audio, and input backend. Uses SDL2.
+// Video, audio, and input backend. Uses SDL2. HEADLESS=1 builds use a
+// backend without SDL that implements the same interface
+// (headless_backend.cpp); the SDL-specific parts are left out there.
 
-#include <SDL.h>
+#ifndef HEADLESS
+#  include <SDL.h>
+#endif
 
 void init_sdl();
 void deinit_sdl();
@@ -14,18 +18,26 @@ void exit_sdl_thread();
 
 // Video
 
+// Dimensions of the frame buffer. Each line includes NES_PPU_OFFSET pixels of
+// padding to the left of the picture.
+#define NES_PPU_W 282
+#define NES_PPU_H 240
+#define NES_PPU_OFFSET 15
+
 void put_pixel(int x, unsigned y, uint32_t color);
+// Writes 'n' pixels starting at 'x' on line 'y'
+void put_pixels(int x, unsigned y, uint32_t const *colors, unsigned n);
 void draw_frame();
 
+// Returns the most recently completed frame (NES_PPU_W*NES_PPU_H ARGB pixels).
+// Only meaningful in headless mode, where no other thread reads the frame
+// buffers.
+uint32_t const *completed_frame();
+
 // Audio
 
 int const sample_rate = 44100;
 
-// Protect the audio buffer from concurrent access by the emulation thread and
-// SDL
-void lock_audio();
-void unlock_audio();
-
 // Stop and start audio playback in SDL, returns old state.
 int audio_pause(bool value);
 
@@ -69,12 +81,15 @@ enum debug_inputs {
   ID_COUNT,
 };
 
-extern bool controller_inputs[4][I_COUNT];
-extern bool global_inputs[IG_COUNT];
-extern bool debug_inputs[ID_COUNT];
+extern EMU_STATE bool controller_inputs[4][I_COUNT];
+extern EMU_STATE bool global_inputs[IG_COUNT];
 
 void handle_ui_keys();
 
+#ifndef HEADLESS
+
+extern bool debug_inputs[ID_COUNT];
+
 extern SDL_mutex *event_lock;
 //extern Uint8 const *keys;
 
@@ -104,3 +119,5 @@ int sdl_text_prompt(const char* prompt, char* value, size_t value_sz);
 
 extern Uint8 debug_contents[DBG_COLUMNS * DBG_ROWS];
 extern Uint8 debug_colors[DBG_COLUMNS * DBG_ROWS];
+
+#endif
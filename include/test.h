@@ -1,7 +1,10 @@
 // Automatic verification of test ROMs
 
-void run_tests();
+// Runs the test ROMs in the tests/ directory and prints the results. In
+// HEADLESS=1 builds, the tests are spread across all cores. Returns true if all
+// tests passed.
+bool run_tests();
 void report_status_and_end_test(uint8_t status, char const *msg);
 
 // Hack to exit early during testing
-extern bool end_testing;
+extern EMU_STATE bool end_testing;
@@ -1,13 +1,55 @@
-extern double cpu_clock_rate;
-extern double ppu_clock_rate;
-extern double ppu_fps;
+extern EMU_STATE double cpu_clock_rate;
+extern EMU_STATE double ppu_clock_rate;
+extern EMU_STATE double ppu_fps;
 
+// Starts pacing frames from the current time. Called when emulation starts.
 void init_timing();
 void init_timing_for_rom();
 
-// Sleeps until the end of the frame if we manage to emulate it faster than
-// realtime (which should hopefully be the case)
+// If set (--sync-to-display), frames are paced at the display refresh rate
+// rather than the emulated frame rate, provided they're close. This avoids a
+// frame being shown twice or skipped every so often. The small difference in
+// speed is made up for by adjusting the audio playback rate.
+extern EMU_STATE bool sync_to_display;
+// Called by the SDL backend with the refresh rate of the display. 0 means
+// unknown.
+void set_display_refresh_rate(double hz);
+
+// Fast-forward (held down with Tab). While 'fast_forward' is set, frames are
+// run at 'fast_forward_speed' times the normal rate, or as fast as possible if
+// it is 0. Only enough frames are shown to keep up with the normal frame rate
+// (see skip_next_frame()), and audio is muted.
+extern EMU_STATE bool fast_forward;
+extern EMU_STATE unsigned fast_forward_speed;
+
+// Waits until the end of the frame if we manage to emulate it faster than
+// realtime (which should hopefully be the case). When fast-forwarding, waits
+// until the end of the shortened frame instead, if there's a speed limit. See
+// timing.cpp for how frames are paced.
 void sleep_till_end_of_frame();
 
+// Frame pacing statistics since emulation started. Frames run while
+// fast-forwarding aren't included.
+struct Frame_pacing_stats {
+    unsigned long frames;
+    // Frames that took longer than the frame period to emulate
+    unsigned long late_frames;
+    // Times the schedule was restarted after falling too far behind
+    unsigned long resyncs;
+    // Time between the ends of consecutive frames, in seconds
+    double interval_sum, interval_sum_sq, interval_max;
+    // How long after its deadline each frame ended, in seconds
+    double lateness_sum, lateness_max;
+};
+extern EMU_STATE Frame_pacing_stats frame_pacing_stats;
+
+// Prints a summary of frame_pacing_stats (--pacing-stats)
+void print_frame_pacing_stats();
+
+// Returns true if the next frame should be skipped rather than shown. Only
+// ever true while fast-forwarding. Called once per frame after
+// sleep_till_end_of_frame().
+bool skip_next_frame();
+
 // Hack to get a C++03 compile-time constant
 unsigned const pal_milliframes_per_second = 50007;
@@ -10,7 +10,7 @@
 // Clock used by the APU and DMA circuitry, parts of which tick at half the CPU
 // frequency. Whether the initial tick is high or low seems to be random. The
 // name apu_clk1 is from Visual 2A03.
-static bool apu_clk1_is_high;
+static EMU_STATE bool apu_clk1_is_high;
 
 //
 // OAM (sprite data) DMA
@@ -19,13 +19,19 @@ static bool apu_clk1_is_high;
 
 // Current OAM DMA state. Needed to get the timing for APU DMC sample loading
 // right (tested by the sprdma_and_dmc_dma tests).
-static enum OAM_DMA_state {
+static EMU_STATE enum OAM_DMA_state {
     OAM_DMA_IN_PROGRESS = 0,
     OAM_DMA_IN_PROGRESS_3RD_TO_LAST_TICK,
     OAM_DMA_IN_PROGRESS_LAST_TICK,
     OAM_DMA_NOT_IN_PROGRESS
 } oam_dma_state;
 
+// OAM DMA writes go directly to $2004, bypassing write_mem()
+static void write_oam_data(uint8_t val) {
+    sync_ppu();
+    write_oam_data_reg(val);
+}
+
 void do_oam_dma(uint8_t addr) {
     // We get either WDTTT... or WDDTTT... where W is the write cycle, D a
     // dummy cycle, and T a transfer cycle (there's 512 of them). The extra
@@ -46,19 +52,19 @@ void do_oam_dma(uint8_t addr) {
         // visible in any way though.
         cpu_data_bus = read_mem(start_addr + i);
         tick();
-        write_oam_data_reg(cpu_data_bus);
+        write_oam_data(cpu_data_bus);
     }
 
     cpu_data_bus = read_mem(start_addr + 254);
     oam_dma_state = OAM_DMA_IN_PROGRESS_3RD_TO_LAST_TICK;
     tick();
-    write_oam_data_reg(cpu_data_bus);
+    write_oam_data(cpu_data_bus);
     oam_dma_state = OAM_DMA_IN_PROGRESS;
 
     cpu_data_bus = read_mem(start_addr + 255);
     oam_dma_state = OAM_DMA_IN_PROGRESS_LAST_TICK;
     tick();
-    write_oam_data_reg(cpu_data_bus);
+    write_oam_data(cpu_data_bus);
 
     oam_dma_state = OAM_DMA_NOT_IN_PROGRESS;
 }
@@ -66,7 +72,7 @@ void do_oam_dma(uint8_t addr) {
 
 // Set when the output level of any channel changes. Lets us skip the mixing
 // step most of the time.
-static bool channel_updated;
+static EMU_STATE bool channel_updated;
 
 void begin_audio_frame() { channel_updated = true; }
 
@@ -79,7 +85,7 @@ uint8_t const len_table[] = {
 // Pulse channels
 //
 
-static struct Pulse {
+static EMU_STATE struct Pulse {
     // Range 0-15
     // (Potentially) affected by
     //   - volume updates,
@@ -202,21 +208,21 @@ static void clock_pulse_generator(unsigned n) {
 
 // Range 0-15, premultiplied by 3 for mixing. Affected only by waveform
 // position updates.
-static unsigned tri_output_level;
+static EMU_STATE unsigned tri_output_level;
 
-static bool     tri_enabled;
+static EMU_STATE bool     tri_enabled;
 
-static unsigned tri_period;
-static unsigned tri_period_cnt;
+static EMU_STATE unsigned tri_period;
+static EMU_STATE unsigned tri_period_cnt;
 
-static unsigned tri_waveform_pos;
+static EMU_STATE unsigned tri_waveform_pos;
 
-static unsigned tri_len_cnt;
-static bool     tri_halt_flag;
+static EMU_STATE unsigned tri_len_cnt;
+static EMU_STATE bool     tri_halt_flag;
 
-static unsigned tri_lin_cnt_load;
-static unsigned tri_lin_cnt;
-static bool     tri_lin_cnt_reload_flag;
+static EMU_STATE unsigned tri_lin_cnt_load;
+static EMU_STATE unsigned tri_lin_cnt;
+static EMU_STATE bool     tri_lin_cnt_reload_flag;
 
 void write_triangle_reg_0(uint8_t val) {
     tri_halt_flag    = val & 0x80;
@@ -264,21 +270,21 @@ static void clock_triangle_generator() {
 //   - volume updates,
 //   - Length counter updates,
 //   - and shift reg value
-static unsigned noise_output_level;
-
-static bool     noise_enabled;
-
-static bool     noise_halt_len_loop_env;
-static bool     noise_const_vol;
-static unsigned noise_vol;
-static unsigned noise_feedback_bit;
-static unsigned noise_period;
-static unsigned noise_period_cnt;
-static unsigned noise_len_cnt;
-static unsigned noise_shift_reg;
-static bool     noise_env_start_flag;
-static unsigned noise_env_vol;
-static unsigned noise_env_div_cnt;
+static EMU_STATE unsigned noise_output_level;
+
+static EMU_STATE bool     noise_enabled;
+
+static EMU_STATE bool     noise_halt_len_loop_env;
+static EMU_STATE bool     noise_const_vol;
+static EMU_STATE unsigned noise_vol;
+static EMU_STATE unsigned noise_feedback_bit;
+static EMU_STATE unsigned noise_period;
+static EMU_STATE unsigned noise_period_cnt;
+static EMU_STATE unsigned noise_len_cnt;
+static EMU_STATE unsigned noise_shift_reg;
+static EMU_STATE bool     noise_env_start_flag;
+static EMU_STATE unsigned noise_env_vol;
+static EMU_STATE unsigned noise_env_div_cnt;
 
 static void update_noise_output_level() {
     unsigned const prev_output_level = noise_output_level;
@@ -305,7 +311,7 @@ uint16_t const ntsc_noise_periods[] =
   { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 };
 uint16_t const pal_noise_periods[]  =
   { 4, 8, 14, 30, 60, 88, 118, 148, 188, 236, 354, 472, 708,  944, 1890, 3778 };
-static uint16_t const *noise_periods;
+static EMU_STATE uint16_t const *noise_periods;
 
 // $400E
 void write_noise_reg_1(uint8_t val) {
@@ -335,43 +341,43 @@ static void clock_noise_generator() {
 
 // Range 0-127
 // Counter value directly determines output level
-static unsigned dmc_counter;
+static EMU_STATE unsigned dmc_counter;
 
 // Set by the last sample byte being loaded, unless inhibited or looping is set
 // Cleared by
 //  * the reset signal,
 //  * writing $4015,
 //  * and clearing the IRQ enable flag in $4010
-bool            dmc_irq;
+EMU_STATE bool            dmc_irq;
 // $4010
-static bool     dmc_irq_enabled;
-static bool     dmc_loop_sample;
-static unsigned dmc_period;
-static unsigned dmc_period_cnt;
+static EMU_STATE bool     dmc_irq_enabled;
+static EMU_STATE bool     dmc_loop_sample;
+static EMU_STATE unsigned dmc_period;
+static EMU_STATE unsigned dmc_period_cnt;
 
 // $4012, missing the implied "| 0x8000" that puts it into ROM
-static unsigned dmc_sample_start_addr;
+static EMU_STATE unsigned dmc_sample_start_addr;
 // $4013
-static unsigned dmc_sample_len;
+static EMU_STATE unsigned dmc_sample_len;
 
-static uint8_t  dmc_sample_buffer;
-static bool     dmc_sample_buffer_has_data;
-static uint8_t  dmc_shift_reg;
-static bool     dpcm_active;
+static EMU_STATE uint8_t  dmc_sample_buffer;
+static EMU_STATE bool     dmc_sample_buffer_has_data;
+static EMU_STATE uint8_t  dmc_shift_reg;
+static EMU_STATE bool     dpcm_active;
 
 // True while a sample byte is being loaded, to prevent recursion in
 // load_dmc_sample_byte(). This also mirrors how the hardware behaves.
-static bool     dmc_loading_sample_byte;
+static EMU_STATE bool     dmc_loading_sample_byte;
 
-static unsigned dmc_sample_cur_addr; // 15 bits wide
-static unsigned dmc_bytes_remaining;
-static unsigned dmc_bits_remaining;
+static EMU_STATE unsigned dmc_sample_cur_addr; // 15 bits wide
+static EMU_STATE unsigned dmc_bytes_remaining;
+static EMU_STATE unsigned dmc_bits_remaining;
 
 uint16_t const ntsc_dmc_periods[] =
  { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106,  84,  72,  54 };
 uint16_t const pal_dmc_periods[] =
  { 398, 354, 316, 298, 276, 236, 210, 198, 176, 148, 132, 118,  98,  78,  66,  50 };
-static uint16_t const *dmc_periods;
+static EMU_STATE uint16_t const *dmc_periods;
 
 void write_dmc_reg_0(uint8_t val) {
     if (!(dmc_irq_enabled = val & 0x80))
@@ -477,13 +483,13 @@ static void clock_dmc() {
 //  * the reset signal,
 //  * setting the inhibit IRQ flag,
 //  * and reading $4015
-bool        frame_irq;
+EMU_STATE bool        frame_irq;
 
-static enum Frame_counter_mode { FOUR_STEP = 0, FIVE_STEP = 1 } frame_counter_mode;
-static bool inhibit_frame_irq;
-static unsigned frame_counter_clock;
+static EMU_STATE enum Frame_counter_mode { FOUR_STEP = 0, FIVE_STEP = 1 } frame_counter_mode;
+static EMU_STATE bool inhibit_frame_irq;
+static EMU_STATE unsigned frame_counter_clock;
 
-static unsigned delayed_frame_timer_reset;
+static EMU_STATE unsigned delayed_frame_timer_reset;
 
 // Quarter frame
 static void clock_env_and_tri_lin() {
@@ -3,6 +3,8 @@
 #include "audio.h"
 #include "cpu.h"
 #include "blip_buf.h"
+#include "headless.h"
+#include "metrics.h"
 #include "save_states.h"
 #include "sdl_backend.h"
 #include "timing.h"
@@ -11,119 +13,89 @@
 // Audio ring buffer
 //
 
-// Make room for 1/6th seconds of delay
-static int16_t buf[GE_POW_2(sample_rate/6)];
-// Indices from start_index up to but not including end_index (modulo wrapping)
-// contain samples
-static size_t start_index = 0, end_index = 0;
-// True if the last operation was a read. Indicates whether
-// start_index == end_index means the buffer is full or empty.
-static bool prev_op_was_read = true;
-
-void read_samples(int16_t *dst, size_t len) {
-    assert(start_index < ARRAY_LEN(buf));
-
-    // Move samples from the ring buffer to 'dst' by memcpy()ing contiguous
-    // segments
-
-    // How many contiguous bytes are available...?
+// Single-producer/single-consumer ring buffer between the emulation thread
+// (which writes) and the SDL audio callback (which reads). No locks are
+// needed: each side only advances its own index, and the indices are
+// published with release stores and read with acquire loads, so that the
+// samples between them are visible to the other side before the index is.
 
-    size_t contig_avail;
-    if ((start_index == end_index && !prev_op_was_read) || start_index > end_index)
-        contig_avail = ARRAY_LEN(buf) - start_index;
-    else
-        contig_avail = end_index - start_index;
+// Make room for 1/6th seconds of delay. The size is a power of two, so the
+// free-running indices below can wrap around without breaking the modulo.
+static int16_t buf[GE_POW_2(sample_rate/6)];
+// Total number of samples read and written. Only the audio callback changes
+// read_pos and only the emulation thread changes write_pos. The samples from
+// read_pos up to but not including write_pos (modulo the buffer size) are
+// unread, which unlike start and end indices makes a full buffer
+// distinguishable from an empty one.
+static size_t read_pos, write_pos;
+
+// Copies 'len' samples starting at 'pos' (modulo the buffer size) from the
+// ring buffer to 'dst'
+static void copy_from_ring(int16_t *dst, size_t pos, size_t len) {
+    size_t const index = pos % ARRAY_LEN(buf);
+    size_t const contig_len = min(len, ARRAY_LEN(buf) - index);
+    memcpy(dst, buf + index, sizeof(*buf)*contig_len);
+    memcpy(dst + contig_len, buf, sizeof(*buf)*(len - contig_len));
+}
 
-    prev_op_was_read = true;
+// Copies 'len' samples from 'src' to the ring buffer starting at 'pos'
+// (modulo the buffer size)
+static void copy_to_ring(size_t pos, int16_t const *src, size_t len) {
+    size_t const index = pos % ARRAY_LEN(buf);
+    size_t const contig_len = min(len, ARRAY_LEN(buf) - index);
+    memcpy(buf + index, src, sizeof(*buf)*contig_len);
+    memcpy(buf, src + contig_len, sizeof(*buf)*(len - contig_len));
+}
 
-    if (contig_avail >= len) {
-        // ...as many as we need. Copy it all in one go.
-        memcpy(dst, buf + start_index, sizeof(*buf)*len);
-        start_index = (start_index + len) % ARRAY_LEN(buf);
-    }
-    else {
-        // ... less than we need. Copy the contiguous segment first.
-        memcpy(dst, buf + start_index, sizeof(*buf)*contig_avail);
-        len -= contig_avail;
-        assert(len > 0);
-        // Move past the contiguous segment - possibly to index 0
-        start_index = (start_index + contig_avail) % ARRAY_LEN(buf);
-        assert(start_index <= end_index);
-        // How many contiguous bytes are available now...?
-        size_t const avail = end_index - start_index;
-        if (avail >= len) {
-            // ...as many as we need. Copy the rest.
-            memcpy(dst + contig_avail, buf + start_index, sizeof(*buf)*len);
-            start_index += len;
-            assert(start_index <= end_index);
-        }
-        else {
-            // ...less than we need. Copy as much as we can and zero-fill
-            // the rest of the output buffer, as required by SDL2.
-            memcpy(dst + contig_avail, buf + start_index, sizeof(*buf)*avail);
-            memset(dst + contig_avail + avail, 0, sizeof(*buf)*(len - avail));
-            assert(start_index + avail == end_index);
-            start_index = end_index;
+void read_samples(int16_t *dst, size_t len) {
+    size_t const pos   = read_pos;
+    size_t const avail = __atomic_load_n(&write_pos, __ATOMIC_ACQUIRE) - pos;
+    size_t const n     = min(len, avail);
+
+    copy_from_ring(dst, pos, n);
+    // Hand the space back to the emulation thread
+    __atomic_store_n(&read_pos, pos + n, __ATOMIC_RELEASE);
+
+    if (n < len) {
+        // Zero-fill the rest of the output buffer, as required by SDL2
+        memset(dst + n, 0, sizeof(*buf)*(len - n));
+        count_metric(COUNTER_AUDIO_UNDERFLOWS);
 #ifndef RUN_TESTS
-            printf("audio buffer underflow by %zu!\n",len - avail);
+        printf("audio buffer underflow by %zu!\n", len - n);
 #endif
-        }
     }
 }
 
 // Writes up to 'len' samples from 'src' to the ring buffer. In case of
-// overflow, writes as many samples as possible and returns 'false'.
+// overflow, writes as many samples as possible and drops the rest.
 static void write_samples(int16_t const *src, size_t len) {
-    // Copy samples from 'src' to the ring buffer by memcpy()ing contiguous
-    // segments
-
-    // How many contiguous bytes are available...?
+    size_t const pos  = write_pos;
+    size_t const space = ARRAY_LEN(buf) - (pos - __atomic_load_n(&read_pos, __ATOMIC_ACQUIRE));
+    size_t const n     = min(len, space);
 
-    size_t contig_avail;
-    if (start_index < end_index || (start_index == end_index && prev_op_was_read))
-        contig_avail = ARRAY_LEN(buf) - end_index;
-    else
-        contig_avail = start_index - end_index;
+    copy_to_ring(pos, src, n);
+    // Publish the samples to the audio callback
+    __atomic_store_n(&write_pos, pos + n, __ATOMIC_RELEASE);
 
-    prev_op_was_read = false;
-
-    if (contig_avail >= len) {
-        // ...as many as we need. Copy it all in one go.
-        memcpy(buf + end_index, src, sizeof(*buf)*len);
-        end_index = (end_index + len) % ARRAY_LEN(buf);
-    }
-    else {
-        // ...less than we need. Fill the contiguous segment first.
-        memcpy(buf + end_index, src, sizeof(*buf)*contig_avail);
-        len -= contig_avail;
-        assert(len > 0);
-        // Move past the contiguous segment - possibly to index 0
-        end_index = (end_index + contig_avail) % ARRAY_LEN(buf);
-        assert(end_index <= start_index);
-        // How many contiguous bytes are available now...?
-        size_t const avail = start_index - end_index;
-        if (avail >= len) {
-            // ...as many as we need. Copy the rest.
-            memcpy(buf + end_index, src + contig_avail, sizeof(*buf)*len);
-            end_index += len;
-            assert(end_index <= start_index);
-        }
-        else {
-            // ...less than we need. Copy as much as we can and drop the
-            // rest.
-            memcpy(buf + end_index, src + contig_avail, sizeof(*buf)*avail);
-            assert(end_index + avail == start_index);
-            end_index = start_index;
+    if (n < len) {
+        count_metric(COUNTER_AUDIO_OVERFLOWS);
 #ifndef RUN_TESTS
-            puts("audio buffer overflow!");
+        puts("audio buffer overflow!");
 #endif
-        }
     }
 }
 
+// Drops all unread samples. Only safe while the audio device is paused, so
+// that the audio callback isn't running.
+static void discard_samples() {
+    __atomic_store_n(&write_pos, __atomic_load_n(&read_pos, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELEASE);
+}
+
 // Returns the fill level of the ring buffer as a double in the range 0.0-1.0.
+// Called from the emulation thread.
 static double fill_level() {
-    double const data_len = (end_index - start_index) % ARRAY_LEN(buf);
+    double const data_len = write_pos - __atomic_load_n(&read_pos, __ATOMIC_ACQUIRE);
     return data_len/ARRAY_LEN(buf);
 }
 
@@ -131,7 +103,9 @@ static double fill_level() {
 // Initialization, resampling, and buffer management
 //
 
-static blip_t *blip;
+static EMU_STATE blip_t *blip;
+
+EMU_STATE bool discard_audio;
 
 // We try to keep the internal audio buffer 50% full for maximum protection
 // against under- and overflow. To maintain that level, we adjust the playback
@@ -143,18 +117,21 @@ double const max_adjust = 0.015;
 // To avoid an immediate underflow, we wait for the audio buffer to fill up
 // before we start playing. This is set true when we're happy with the fill
 // level.
-static bool playback_started;
+static EMU_STATE bool playback_started;
 
 // Leave some extra room in the buffer to allow audio to be slowed down. Assume
 // PAL, which gives a slightly larger buffer than NTSC. (The expression is
 // equivalent to 1.3*sample_rate/frames_per_second, but a compile-time constant
 // in C++03.)
 // TODO: Make dependent on max_adjust.
-static int16_t blip_samples[1300*sample_rate/pal_milliframes_per_second];
+static EMU_STATE int16_t blip_samples[1300*sample_rate/pal_milliframes_per_second];
 
 void set_audio_signal_level(int16_t level) {
     // TODO: Do something to reduce the initial pop here?
-    static int16_t previous_signal_level = 0;
+    static EMU_STATE int16_t previous_signal_level = 0;
+
+    if (discard_audio)
+        return;
 
     unsigned time  = frame_offset;
     int      delta = level - previous_signal_level;
@@ -190,6 +167,9 @@ void set_audio_signal_level(int16_t level) {
 }
 
 void end_audio_frame() {
+    if (discard_audio)
+        return;
+
     if (frame_offset == 0)
         // No audio added; blip_end_frame() dislikes being called with an
         // offset of 0
@@ -203,12 +183,29 @@ void end_audio_frame() {
 
     blip_end_frame(blip, frame_offset);
 
-    if (playback_started) {
+    // Nothing drains the ring buffer in headless mode, so there's no fill
+    // level to steer towards. Samples are generated at the nominal rate.
+    if (headless)
+        ;
+    else if (fast_forward) {
+        // Audio is muted while fast-forwarding. Once it ends, playback restarts
+        // as usual when the buffer has filled back up, without the samples
+        // left over from before.
+        if (playback_started) {
+            audio_pause(1);
+            discard_samples();
+            playback_started = false;
+        }
+    }
+    else if (playback_started) {
         // Fudge playback rate by an amount proportional to the difference
         // between the desired and current buffer fill levels to try to steer
         // towards it
 
-        double const fudge_factor = 1.0 + 2*max_adjust*(0.5 - fill_level());
+        double const fill = fill_level();
+        record_metric(METRIC_AUDIO_FILL, 100*fill);
+
+        double const fudge_factor = 1.0 + 2*max_adjust*(0.5 - fill);
         blip_set_rates(blip, cpu_clock_rate, sample_rate*fudge_factor);
     }
     else {
@@ -233,11 +230,16 @@ void end_audio_frame() {
     add_movie_audio_frame(blip_samples, n_samples);
 #endif
 
-    // Save the samples to the audio ring buffer
+    if (headless) {
+        headless_audio_samples(blip_samples, n_samples);
+        return;
+    }
+
+    if (fast_forward)
+        return;
 
-    lock_audio();
+    // Save the samples to the audio ring buffer
     write_samples(blip_samples, n_samples);
-    unlock_audio();
 }
 
 void init_audio_for_rom() {
@@ -0,0 +1,190 @@
+#include "common.h"
+
+#include "apu.h"
+#include "benchmark.h"
+#include "cpu.h"
+#include "headless.h"
+#include "mapper.h"
+#include "ppu.h"
+#include "rom.h"
+#include "save_states.h"
+
+EMU_STATE bool benchmarking;
+EMU_STATE bool bench_timing;
+
+EMU_STATE uint64_t bench_time[N_BENCH_COMPONENTS];
+EMU_STATE uint64_t bench_ppu_dots;
+
+// One in this many tick_apu() calls is timed
+unsigned const apu_sample_interval = 16;
+static EMU_STATE unsigned apu_sample_cnt = apu_sample_interval;
+
+// One in this many timed_run_ppu() calls is timed. Calls vary a lot in length,
+// so the PPU time is estimated by scaling the time of the timed calls by the
+// total number of dots over the number of dots they ran.
+unsigned const ppu_sample_interval = 16;
+static EMU_STATE unsigned ppu_sample_cnt = ppu_sample_interval;
+static EMU_STATE uint64_t ppu_sample_time, ppu_sample_dots;
+
+// Time taken by the bench_clock() calls around a timed tick_apu(), which is
+// subtracted from each sample
+static EMU_STATE uint64_t clock_overhead;
+
+static void measure_clock_overhead() {
+    clock_overhead = UINT64_MAX;
+    for (unsigned i = 0; i < 1000; ++i) {
+        uint64_t const start = bench_clock();
+        clock_overhead = min(clock_overhead, bench_clock() - start);
+    }
+}
+
+void timed_tick_apu() {
+    if (--apu_sample_cnt != 0) {
+        tick_apu();
+        return;
+    }
+    apu_sample_cnt = apu_sample_interval;
+
+    uint64_t const start = bench_clock();
+    tick_apu();
+    uint64_t const len = bench_clock() - start;
+    if (len > clock_overhead)
+        bench_time[BENCH_APU] += apu_sample_interval*(len - clock_overhead);
+}
+
+static void run_ppu(unsigned ticks) {
+    if (is_pal)
+        run_pal_ppu(ticks);
+    else
+        run_ntsc_ppu(ticks);
+}
+
+void timed_run_ppu(unsigned ticks) {
+    bench_ppu_dots += ticks;
+    if (!bench_timing || --ppu_sample_cnt != 0) {
+        run_ppu(ticks);
+        return;
+    }
+    ppu_sample_cnt = ppu_sample_interval;
+
+    uint64_t const start = bench_clock();
+    run_ppu(ticks);
+    uint64_t const len = bench_clock() - start;
+    if (len > clock_overhead)
+        ppu_sample_time += len - clock_overhead;
+    ppu_sample_dots += ticks;
+}
+
+void benchmark_end_of_frame() {
+    if (!bench_timing) {
+        handle_rewind(false);
+        return;
+    }
+
+    uint64_t const start = bench_clock();
+    handle_rewind(false);
+    bench_time[BENCH_SNAPSHOT] += bench_clock() - start;
+}
+
+static double wall_time() {
+    timespec ts;
+    errno_fail_if(clock_gettime(CLOCK_MONOTONIC, &ts) == -1,
+                  "failed to get time from clock_gettime()");
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// Prints 's' as a JSON string
+static void print_json_string(char const *s) {
+    putchar('"');
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+// Results of one pass over the ROM
+struct Bench_pass {
+    double seconds, cpu_seconds;
+    uint64_t clock_len;
+    unsigned long frames;
+    unsigned long long instructions;
+    uint64_t ppu_dots;
+};
+
+// Runs 'rom_filename' from power-on for 'n_frames' frames, timing the
+// components if 'timed' is set
+static Bench_pass run_pass(char const *rom_filename, unsigned long n_frames, bool timed) {
+    load_rom(rom_filename, false);
+
+    headless_frame_limit = n_frames;
+    headless_frames_run = 0;
+    bench_ppu_dots = 0;
+    benchmarking = true;
+    bench_timing = timed;
+
+    Bench_pass pass;
+    double const wall_start = wall_time();
+    double const cpu_start = headless_cpu_time();
+    uint64_t const clock_start = bench_clock();
+    run();
+    pass.clock_len   = bench_clock() - clock_start;
+    pass.cpu_seconds = headless_cpu_time() - cpu_start;
+    pass.seconds     = wall_time() - wall_start;
+
+    benchmarking = bench_timing = false;
+
+    pass.frames       = headless_frames_run;
+    pass.instructions = instructions_executed;
+    pass.ppu_dots     = bench_ppu_dots;
+
+    unload_rom();
+
+    return pass;
+}
+
+void run_benchmark(char const *rom_filename, unsigned long n_frames) {
+    Bench_pass const speed = run_pass(rom_filename, n_frames, false);
+
+    measure_clock_overhead();
+    Bench_pass const timed = run_pass(rom_filename, n_frames, true);
+
+    // Scale the sampled PPU time up to all dots run
+    if (ppu_sample_dots != 0)
+        bench_time[BENCH_PPU] = double(ppu_sample_time)*timed.ppu_dots/ppu_sample_dots;
+
+    // bench_clock() units per second
+    double const clock_rate = timed.clock_len/timed.seconds;
+    // Whatever isn't accounted for by the other components. Mostly the CPU
+    // core.
+    uint64_t cpu_time = timed.clock_len;
+    for (unsigned i = 0; i < N_BENCH_COMPONENTS; ++i)
+        cpu_time -= min(cpu_time, bench_time[i]);
+
+    // The speed comes from the untimed pass, and the breakdown from the timed
+    // one. timed_seconds shows how much the timing slowed things down.
+    printf("{\"rom\": ");
+    print_json_string(rom_filename);
+    printf(", \"frames\": %lu, \"seconds\": %.4f, \"cpu_seconds\": %.4f, "
+           "\"timed_seconds\": %.4f, "
+           "\"fps\": %.1f, \"instructions_per_second\": %.0f, "
+           "\"ppu_dots_per_second\": %.0f, \"rewind_budget_mb\": %u, "
+           "\"threaded_dispatch\": %s, "
+           "\"time_seconds\": {\"cpu\": %.4f, \"ppu\": %.4f, \"apu\": %.4f, "
+           "\"end_audio_frame\": %.4f, \"snapshot\": %.4f}}\n",
+           speed.frames, speed.seconds, speed.cpu_seconds, timed.seconds,
+           speed.frames/speed.seconds, speed.instructions/speed.seconds,
+           speed.ppu_dots/speed.seconds, rewind_budget_mb(),
+#ifdef THREADED_DISPATCH
+           "true",
+#else
+           "false",
+#endif
+           cpu_time/clock_rate, bench_time[BENCH_PPU]/clock_rate,
+           bench_time[BENCH_APU]/clock_rate, bench_time[BENCH_AUDIO]/clock_rate,
+           bench_time[BENCH_SNAPSHOT]/clock_rate);
+}
@@ -0,0 +1,138 @@
+#include "common.h"
+
+#include "compose.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define X86_KERNELS
+#endif
+
+bool (*compose_pixels)(uint8_t const *bg, uint8_t const *spr,
+                       uint32_t const *colors, uint32_t *out, unsigned n);
+
+// Same priority logic as do_pixel_output_and_sprite_zero() in ppu.cpp. Also
+// used for the pixels left over after the vectorized loops.
+static bool compose_pixels_scalar(uint8_t const *bg, uint8_t const *spr,
+                                  uint32_t const *colors, uint32_t *out, unsigned n) {
+    bool s0_hit = false;
+
+    for (unsigned i = 0; i < n; ++i) {
+        unsigned pal_index;
+        if (spr[i] && !((spr[i] & SPR_BEHIND_BG) && bg[i]))
+            pal_index = spr[i] & 0x1F;
+        else
+            pal_index = bg[i];
+
+        if ((spr[i] & SPR_ZERO) && bg[i])
+            s0_hit = true;
+
+        out[i] = colors[pal_index];
+    }
+
+    return s0_hit;
+}
+
+#ifdef X86_KERNELS
+
+// 16 pixels at a time. The palette lookup has no SSE2 equivalent and is done
+// one pixel at a time.
+__attribute__((target("sse2")))
+static bool compose_pixels_sse2(uint8_t const *bg, uint8_t const *spr,
+                                uint32_t const *colors, uint32_t *out, unsigned n) {
+    __m128i const zero        = _mm_setzero_si128();
+    __m128i const index_mask  = _mm_set1_epi8(0x1F);
+    __m128i const behind_mask = _mm_set1_epi8(SPR_BEHIND_BG);
+    __m128i const s0_mask     = _mm_set1_epi8(SPR_ZERO);
+
+    int s0_hit_mask = 0;
+    unsigned i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i const bg_v  = _mm_loadu_si128((__m128i const*)(bg + i));
+        __m128i const spr_v = _mm_loadu_si128((__m128i const*)(spr + i));
+
+        __m128i const bg_transp  = _mm_cmpeq_epi8(bg_v, zero);
+        __m128i const spr_transp = _mm_cmpeq_epi8(spr_v, zero);
+        __m128i const behind     =
+          _mm_cmpeq_epi8(_mm_and_si128(spr_v, behind_mask), behind_mask);
+        __m128i const is_s0      =
+          _mm_cmpeq_epi8(_mm_and_si128(spr_v, s0_mask), s0_mask);
+
+        // Background shows through where the sprite is transparent or behind
+        // an opaque background pixel
+        __m128i const show_bg =
+          _mm_or_si128(spr_transp, _mm_andnot_si128(bg_transp, behind));
+        __m128i const pal_index =
+          _mm_or_si128(_mm_and_si128(show_bg, bg_v),
+                       _mm_andnot_si128(show_bg, _mm_and_si128(spr_v, index_mask)));
+
+        s0_hit_mask |= _mm_movemask_epi8(_mm_andnot_si128(bg_transp, is_s0));
+
+        uint8_t pal_indices[16];
+        _mm_storeu_si128((__m128i*)pal_indices, pal_index);
+        for (unsigned j = 0; j < 16; ++j)
+            out[i + j] = colors[pal_indices[j]];
+    }
+
+    return compose_pixels_scalar(bg + i, spr + i, colors, out + i, n - i) ||
+           s0_hit_mask;
+}
+
+// 32 pixels at a time, with the palette lookup done through gathers
+__attribute__((target("avx2")))
+static bool compose_pixels_avx2(uint8_t const *bg, uint8_t const *spr,
+                                uint32_t const *colors, uint32_t *out, unsigned n) {
+    __m256i const zero        = _mm256_setzero_si256();
+    __m256i const index_mask  = _mm256_set1_epi8(0x1F);
+    __m256i const behind_mask = _mm256_set1_epi8(SPR_BEHIND_BG);
+    __m256i const s0_mask     = _mm256_set1_epi8(SPR_ZERO);
+
+    int s0_hit_mask = 0;
+    unsigned i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i const bg_v  = _mm256_loadu_si256((__m256i const*)(bg + i));
+        __m256i const spr_v = _mm256_loadu_si256((__m256i const*)(spr + i));
+
+        __m256i const bg_transp  = _mm256_cmpeq_epi8(bg_v, zero);
+        __m256i const spr_transp = _mm256_cmpeq_epi8(spr_v, zero);
+        __m256i const behind     =
+          _mm256_cmpeq_epi8(_mm256_and_si256(spr_v, behind_mask), behind_mask);
+        __m256i const is_s0      =
+          _mm256_cmpeq_epi8(_mm256_and_si256(spr_v, s0_mask), s0_mask);
+
+        __m256i const show_bg =
+          _mm256_or_si256(spr_transp, _mm256_andnot_si256(bg_transp, behind));
+        __m256i const pal_index =
+          _mm256_blendv_epi8(_mm256_and_si256(spr_v, index_mask), bg_v, show_bg);
+
+        s0_hit_mask |= _mm256_movemask_epi8(_mm256_andnot_si256(bg_transp, is_s0));
+
+        // Widen the indices eight at a time and look up the colors
+        __m128i const lo = _mm256_castsi256_si128(pal_index);
+        __m128i const hi = _mm256_extracti128_si256(pal_index, 1);
+        __m128i const quarters[4] = { lo, _mm_srli_si128(lo, 8), hi, _mm_srli_si128(hi, 8) };
+        for (unsigned j = 0; j < 4; ++j)
+            _mm256_storeu_si256((__m256i*)(out + i + 8*j),
+              _mm256_i32gather_epi32((int const*)colors,
+                                     _mm256_cvtepu8_epi32(quarters[j]), 4));
+    }
+
+    return compose_pixels_scalar(bg + i, spr + i, colors, out + i, n - i) ||
+           s0_hit_mask;
+}
+
+#endif // X86_KERNELS
+
+void init_compose() {
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        compose_pixels = compose_pixels_avx2;
+        return;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        compose_pixels = compose_pixels_sse2;
+        return;
+    }
+#endif
+    compose_pixels = compose_pixels_scalar;
+}
@@ -8,11 +8,14 @@
 
 #include "apu.h"
 #include "audio.h"
+#include "benchmark.h"
 #include "controller.h"
 #include "cpu.h"
 #include "dbg.h"
+#include "headless.h"
 #include "input.h"
 #include "mapper.h"
+#include "metrics.h"
 #include "opcodes.h"
 #include "ppu.h"
 #ifdef RUN_TESTS
@@ -31,45 +34,57 @@
 // Avoids having to check them all for each instruction. This includes
 // interrupts, end-of-frame operations, state transfers, (soft) reset, and
 // shutdown.
-static bool pending_event;
+static EMU_STATE bool pending_event;
 
-static bool pending_end_emulation;
-static bool pending_frame_completion;
-static bool pending_reset;
+static EMU_STATE bool pending_end_emulation;
+static EMU_STATE bool pending_frame_completion;
+static EMU_STATE bool pending_reset;
+
+// True while the debugger needs to see each instruction before it executes.
+// pending_event is then kept set so that every instruction goes through the
+// top of the loop in run(), which keeps dbg_log_instruction() off the normal
+// path.
+static EMU_STATE bool debugging;
 
 void end_emulation()   { pending_event = pending_end_emulation = true; }
 void frame_completed() { pending_event = pending_frame_completion = true; }
 void soft_reset()      { pending_event = pending_reset = true; }
+void debugger_opened() { pending_event = debugging = true; }
 
 // Set true if interrupt polling detects a pending IRQ or NMI. The next
 // "instruction" executed is the interrupt sequence.
-bool pending_irq;
-bool pending_nmi;
+EMU_STATE bool pending_irq;
+EMU_STATE bool pending_nmi;
+
+EMU_STATE unsigned long long instructions_executed;
+
+EMU_STATE unsigned run_ahead_frames;
 
 #ifdef ENABLE_CORRUPTION
-static bool corrupt_now;
-unsigned int randcorrupt = 0;
-unsigned int corrupt_chance = 0;
+static EMU_STATE bool corrupt_now;
+EMU_STATE unsigned int randcorrupt = 0;
+EMU_STATE unsigned int corrupt_chance = 0;
 #endif
 
 #ifdef RUN_TESTS
 // The system is soft-reset when this goes from 1 to 0. Used by test ROMs.
-static unsigned ticks_till_reset;
+static EMU_STATE unsigned ticks_till_reset;
 #endif
 
 //
 // RAM, registers, status flags, and misc. state
 //
 
-uint8_t ram[0x800];
+EMU_STATE uint8_t ram[0x800];
+EMU_STATE uint8_t ram_dirty[0x800/dirty_page_size];
 
 // Possible optimization: Making some of the variables a natural size for the
 // implementation architecture might be faster. CPU emulation is already
 // relatively speedy though, and we wouldn't get automatic wrapping.
 
 // Registers
-uint16_t pc;
-uint8_t a, s, x, y;
+EMU_STATE uint16_t pc;
+EMU_STATE uint8_t a, s, x, y;
 
 // Status flags
 
@@ -82,28 +97,51 @@ uint8_t a, s, x, y;
 // Having zn & 0x100 also indicate that the negative flag is set allows the two
 // flags to be set separately, which is required by the BIT instruction and
 // when pulling flags from the stack.
-unsigned zn;
+EMU_STATE unsigned zn;
 
-bool carry;
-bool irq_disable;
-bool decimal;
-bool overflow;
+EMU_STATE bool carry;
+EMU_STATE bool irq_disable;
+EMU_STATE bool decimal;
+EMU_STATE bool overflow;
 
 // The byte after the opcode byte. Always fetched, so factoring out the fetch
 // saves logic.
-static uint8_t op_1;
+static EMU_STATE uint8_t op_1;
 
-bool cpu_is_reading;
-uint8_t cpu_data_bus;
+EMU_STATE bool cpu_is_reading;
+EMU_STATE uint8_t cpu_data_bus;
 
 //
 // PPU and APU interface
 //
 
-unsigned frame_offset;
+EMU_STATE unsigned frame_offset;
 
 // Down counter for adding an extra PPU tick for PAL
-static unsigned pal_extra_tick;
+static EMU_STATE unsigned pal_extra_tick;
+
+// The PPU is run lazily ("catch-up" scheduling). tick() only counts the PPU
+// ticks owed, and sync_ppu() runs them before anything that could observe or
+// affect the PPU. Running the PPU in batches keeps its code and data hot.
+static EMU_STATE unsigned pending_ppu_ticks;
+// sync_ppu() also runs once pending_ppu_ticks reaches this, so that things
+// the PPU does on its own (asserting NMI and signaling frame completion)
+// happen during the same CPU cycle as without batching. 0 if the PPU needs
+// to run in lockstep with the CPU.
+static EMU_STATE unsigned ppu_sync_deadline;
+
+void sync_ppu() {
+	if (benchmarking)
+		timed_run_ppu(pending_ppu_ticks);
+	else if (is_pal)
+		run_pal_ppu(pending_ppu_ticks);
+	else
+		run_ntsc_ppu(pending_ppu_ticks);
+
+	pending_ppu_ticks = 0;
+
+	ppu_sync_deadline = ppu_ticks_till_event();
+}
 
 void tick() {
 	// For NTSC, there are exactly three PPU ticks per CPU cycle. For PAL the
@@ -111,22 +149,19 @@ void tick() {
 	// call. (This isn't perfect, but about as good as we can do without getting
 	// into super-obscure hardware behavior, including PPU half-ticks and analog
 	// effects.)
-	if (is_pal) {
-		if (--pal_extra_tick == 0) {
-			pal_extra_tick = 5;
-			tick_pal_ppu();
-		}
-		tick_pal_ppu();
-		tick_pal_ppu();
-		tick_pal_ppu();
-	}
-	else {
-		tick_ntsc_ppu();
-		tick_ntsc_ppu();
-		tick_ntsc_ppu();
+	pending_ppu_ticks += 3;
+	if (is_pal && --pal_extra_tick == 0) {
+		pal_extra_tick = 5;
+		++pending_ppu_ticks;
 	}
 
-	tick_apu();
+	if (pending_ppu_ticks >= ppu_sync_deadline)
+		sync_ppu();
+
+	if (bench_timing)
+		timed_tick_apu();
+	else
+		tick_apu();
 
 #ifdef RUN_TESTS
 	if (ticks_till_reset > 0 && --ticks_till_reset == 0)
@@ -153,25 +188,48 @@ static void write_tick() {
 }
 
 
+// CPU memory map in 256-byte pages. Non-null entries point to the memory
+// backing the page, so that RAM, WRAM and PRG accesses only need a single
+// lookup. Null entries are for pages with registers, and for unmapped memory.
+static EMU_STATE uint8_t *read_pages[0x100];
+static EMU_STATE uint8_t *write_pages[0x100];
+// Dirty page flag for each page in write_pages
+static EMU_STATE uint8_t *write_page_dirty[0x100];
+
+void map_cpu_mem(uint16_t addr, unsigned len, uint8_t *mem, uint8_t *dirty) {
+	assert(addr % 0x100 == 0 && len % 0x100 == 0);
+	assert(addr + len <= 0x10000);
+	assert(dirty_page_size == 0x100);
+
+	for (unsigned i = 0; i < len/0x100; ++i) {
+		uint8_t *const page = mem ? mem + 0x100*i : 0;
+		read_pages[addr/0x100 + i]       = page;
+		write_pages[addr/0x100 + i]      = (mem && dirty) ? page : 0;
+		write_page_dirty[addr/0x100 + i] = (mem && dirty) ? dirty + i : 0;
+	}
+}
+
 uint8_t read_mem(uint16_t addr) {
 	read_tick();
 
 	uint8_t res;
 
-	switch (addr) {
-		case 0x0000 ... 0x1FFF: res = ram[addr & 0x7FF];      break;
-		case 0x2000 ... 0x3FFF: res = read_ppu_reg(addr & 7); break;
-		case 0x4015           : res = read_apu_status();      break;
-		case 0x4016           : res = read_controller(0);     break;
-		case 0x4017           : res = read_controller(1);     break;
-		case 0x4018 ... 0x5FFF: res = mapper_fns.read(addr);  break; // General enough?
-		case 0x6000 ... 0x7FFF:
-					// WRAM/SRAM. Returns open bus if none present.
-					res = wram_6000_page ? wram_6000_page[addr & 0x1FFF] : cpu_data_bus;
-					break;
-		case 0x8000 ... 0xFFFF: res = read_prg(addr);         break;
-		default:                res = cpu_data_bus;           break; // Open bus
-	}
+	if (uint8_t const *const page = read_pages[addr >> 8])
+		// RAM, WRAM/SRAM, or PRG
+		res = page[addr & 0xFF];
+	else
+		switch (addr) {
+			case 0x2000 ... 0x3FFF:
+						sync_ppu();
+						res = read_ppu_reg(addr & 7);
+						break;
+			case 0x4015           : res = read_apu_status();      break;
+			case 0x4016           : res = read_controller(0);     break;
+			case 0x4017           : res = read_controller(1);     break;
+			case 0x4018 ... 0x5FFF: res = mapper_fns.read(addr);  break; // General enough?
+			// Includes $6000-$7FFF if no WRAM/SRAM is present
+			default:                res = cpu_data_bus;           break; // Open bus
+		}
 
 	cpu_data_bus = res;
 	return res;
@@ -180,9 +238,29 @@ uint8_t read_mem(uint16_t addr) {
 void write_mem_inst(uint8_t val, uint16_t addr) {
 	// this function is used by the debugger to modify memory instantly.
 
-	switch (addr) {
-		case 0x0000 ... 0x1FFF: ram[addr & 0x7FF] = val;      break;
-		case 0x2000 ... 0x3FFF: write_ppu_reg(val, addr & 7); break;
+#ifdef RUN_TESTS
+	// blargg's test ROMs write the test status to $6000 and a corresponding
+	// text string to $6004
+	if (addr == 0x6000) {
+		if (val < 0x80)
+			report_status_and_end_test(val, (char*)wram_6000_page + 4);
+		else if (val == 0x81)
+			// Wait 150 ms before resetting
+			ticks_till_reset = 0.15*cpu_clock_rate;
+	}
+#endif
+
+	if (uint8_t *const page = write_pages[addr >> 8]) {
+		// RAM, WRAM/SRAM, or PRG RAM. Writes to PRG ROM and unmapped memory
+		// are ignored.
+		page[addr & 0xFF] = val;
+		*write_page_dirty[addr >> 8] = 1;
+	}
+	else switch (addr) {
+		case 0x2000 ... 0x3FFF:
+			sync_ppu();
+			write_ppu_reg(val, addr & 7);
+			break;
 
 		case 0x4000: write_pulse_reg_0(0, val); break;
 		case 0x4001: write_pulse_reg_1(0, val); break;
@@ -212,29 +290,17 @@ void write_mem_inst(uint8_t val, uint16_t addr) {
 		case 0x4015: write_apu_status(val);            break;
 		case 0x4016: write_controller_strobe(val & 1); break;
 		case 0x4017: write_frame_counter(val);         break;
-
-		case 0x6000 ... 0x7FFF:
-			     // SRAM/WRAM/PRG RAM
-#ifdef RUN_TESTS
-			     // blargg's test ROMs write the test status to $6000 and a
-			     // corresponding text string to $6004
-			     if (addr == 0x6000) {
-				     if (val < 0x80)
-					     report_status_and_end_test(val, (char*)wram_6000_page + 4);
-				     else if (val == 0x81)
-					     // Wait 150 ms before resetting
-					     ticks_till_reset = 0.15*cpu_clock_rate;
-			     }
-#endif
-			     if (wram_6000_page) wram_6000_page[addr & 0x1FFF] = val;
-			     break;
-
-		case 0x8000 ... 0xFFFF: write_prg(addr, val); break;
 	}
 
 	// An alternative to letting the mapper see all writes would be to have
 	// separate functions for common address ranges that trigger mapper
 	// operations
+	//
+	// Mapper registers live at $4020-$5FFF and $8000-$FFFF. Writes there
+	// might switch CHR banks or change mirroring, so bring the PPU up to date
+	// first.
+	if ((addr >= 0x4020 && addr < 0x6000) || addr >= 0x8000)
+		sync_ppu();
 	mapper_fns.write(val, addr);
 }
 
@@ -462,6 +528,7 @@ static void branch_if(bool cond) {
 static void push(uint8_t val) {
 	write_tick();
 	ram[0x100 + s--] = val;
+	ram_dirty[0x100/dirty_page_size] = 1;
 }
 
 static uint8_t pull() {
@@ -521,6 +588,7 @@ static void pull_flags() {
 		poll_for_interrupt();                          \
 		write_tick();                                  \
 		ram[op_1] = fn(ram[op_1]);                     \
+		ram_dirty[0] = 1;                              \
 	} while(0)
 
 #define ZERO_X_RMW(fn)                                  \
@@ -533,6 +601,7 @@ static void pull_flags() {
 		poll_for_interrupt();                           \
 		write_tick();                                   \
 		ram[addr] = fn(ram[addr]);                      \
+		ram_dirty[0] = 1;                               \
 	} while(0)
 
 //
@@ -566,6 +635,7 @@ static void zero_write(uint8_t val) {
 	poll_for_interrupt();
 	write_tick();
 	ram[op_1] = val;
+	ram_dirty[0] = 1;
 }
 
 static void zero_xy_write(uint8_t val, uint8_t index) {
@@ -574,6 +644,7 @@ static void zero_xy_write(uint8_t val, uint8_t index) {
 	poll_for_interrupt();
 	write_tick();
 	ram[(op_1 + index) & 0xFF] = val;
+	ram_dirty[0] = 1;
 }
 
 
@@ -702,13 +773,13 @@ static void unoff_addr_write(uint16_t addr, uint8_t val, uint8_t index) {
 //
 
 // IRQ from mapper hardware on the cart
-static bool cart_irq;
+static EMU_STATE bool cart_irq;
 
 // The OR of all IRQ sources. Updated in update_irq_status().
-static bool irq_line;
+static EMU_STATE bool irq_line;
 
 // Set true when a falling edge occurs on the NMI input
-static bool nmi_asserted;
+static EMU_STATE bool nmi_asserted;
 
 static void update_irq_status() {
 	irq_line = cart_irq || dmc_irq || frame_irq;
@@ -811,6 +882,138 @@ extern uint8_t const polls_irq_after_first_cycle[256];
 static void set_cpu_cold_boot_state();
 static void reset_cpu();
 
+// Returns true if the pixels of the next frame won't be shown or otherwise
+// looked at, so that the PPU can skip producing them (see ppu_no_video)
+static bool next_frame_unseen() {
+#ifdef RECORD_MOVIE
+	// Every frame goes into the movie
+	return false;
+#else
+	// Benchmarks measure the full per-frame work
+	if (benchmarking)
+		return false;
+	if (headless)
+		return !headless_video_needed();
+#  ifdef RUN_TESTS
+	return false;
+#  else
+	return skip_next_frame();
+#  endif
+#endif
+}
+
+// Frames left to run ahead, including the current one. 0 while running the
+// real frame.
+static EMU_STATE unsigned run_ahead_left;
+// True if frames will be run ahead at the end of the real frame being run. The
+// last of them is shown in its place.
+static EMU_STATE bool will_run_ahead;
+// Length of the real frame in CPU cycles (frame_offset at its end), saved
+// while running ahead
+static EMU_STATE unsigned real_frame_len;
+
+// Returns true if it's okay to run ahead at the end of the next real frame.
+// Rewinding is left alone, and there's no latency to hide without a window.
+static bool can_run_ahead() {
+	return run_ahead_frames > 0 && !headless && !debugging && !is_backwards_frame;
+}
+
+// Picks whether the PPU produces pixels for the next frame
+static void set_next_frame_video() {
+	if (run_ahead_left > 1 || (run_ahead_left == 0 && will_run_ahead))
+		// Only the last frame run ahead is shown
+		ppu_no_video = true;
+	else
+		ppu_no_video = next_frame_unseen();
+}
+
+// Reads input for the next real frame and handles everything else that
+// happens between real frames
+static void prepare_next_real_frame() {
+	metrics_end_of_frame();
+
+	calc_controller_state();
+	handle_ui_keys();
+	if (benchmarking)
+		benchmark_end_of_frame();
+	// Checked after handle_ui_keys(), as rewinding might load a state
+	// with reset held
+	if (reset_pushed)
+		soft_reset();
+	handle_autosave();
+	if (headless)
+		headless_end_of_frame();
+
+	will_run_ahead = can_run_ahead();
+	set_next_frame_video();
+}
+
+// Called at the end of each real (not run-ahead) frame
+static void end_real_frame() {
+	if (!will_run_ahead) {
+		// Run tests and headless sessions as fast as we can
+#ifndef RUN_TESTS
+		if (!headless)
+			sleep_till_end_of_frame();
+#endif
+		if (!ppu_no_video)
+			draw_frame();
+	}
+	if (bench_timing) {
+		uint64_t const bench_start = bench_clock();
+		end_audio_frame();
+		bench_time[BENCH_AUDIO] += bench_clock() - bench_start;
+	}
+	else
+		end_audio_frame();
+	begin_audio_frame();
+
+	if (will_run_ahead) {
+		// Run the next run_ahead_frames frames with the same input and no
+		// audio, show the last one, and then load this state back
+		save_run_ahead_state();
+		real_frame_len = frame_offset;
+		run_ahead_left = run_ahead_frames;
+		discard_audio = true;
+		set_next_frame_video();
+	}
+	else
+		prepare_next_real_frame();
+}
+
+// Called at the end of each frame run ahead
+static void end_run_ahead_frame() {
+	if (--run_ahead_left > 0) {
+		set_next_frame_video();
+		return;
+	}
+
+	// Last frame run ahead. Show it in place of the real frame.
+#ifndef RUN_TESTS
+	sleep_till_end_of_frame();
+#endif
+	if (!ppu_no_video)
+		draw_frame();
+
+	load_run_ahead_state();
+	// The rewind snapshot taken next records the length of the frame that
+	// led up to it, which is the real frame and not the one just run ahead
+	frame_offset = real_frame_len;
+	discard_audio = false;
+	begin_audio_frame();
+	prepare_next_real_frame();
+}
+
+// Goes back to the real frame if running ahead, e.g. so that the state saved
+// at exit isn't from a frame that never really happened
+static void stop_running_ahead() {
+	if (run_ahead_left > 0) {
+		load_run_ahead_state();
+		run_ahead_left = 0;
+		discard_audio = false;
+	}
+}
+
 // See pending_event
 static void process_pending_events() {
 	if (pending_nmi) {
@@ -826,15 +1029,10 @@ static void process_pending_events() {
 	if (pending_frame_completion) {
 		pending_frame_completion = false;
 
-		// Run tests as fast as we can
-#ifndef RUN_TESTS
-		sleep_till_end_of_frame();
-#endif
-		draw_frame();
-		end_audio_frame();
-		begin_audio_frame();
-		calc_controller_state();
-		handle_ui_keys();
+		if (run_ahead_left > 0)
+			end_run_ahead_frame();
+		else
+			end_real_frame();
 
 		frame_offset = 0;
 	}
@@ -845,503 +1043,581 @@ static void process_pending_events() {
 		// Reset the APU and PPU first since they should tick during the
 		// CPU's reset sequence
 		reset_apu();
+		sync_ppu();
 		reset_ppu();
+		// The PPU position changed. This recomputes the sync deadline.
+		sync_ppu();
 		reset_cpu();
 	}
 }
 
+// Called before each instruction while debugging. Returns false if the
+// instruction shouldn't run yet because emulation is paused in the debugger.
+static bool run_debugger() {
+	// Come back here before the next instruction too
+	pending_event = true;
+
+	bool const resume = dbg_log_instruction();
+	debugging = debugger_active();
+	if (!resume) {
+		sleep_till_end_of_frame();
+		draw_frame();
+		handle_ui_keys();
+	}
+
+	return resume;
+}
+
+// Fetches the opcode and the byte after it (op_1) for the next instruction.
+// Returns the opcode.
+static uint8_t fetch_instruction() {
+	uint8_t const opcode = read_mem(pc++);
+	if (polls_irq_after_first_cycle[opcode])
+		poll_for_interrupt();
+	op_1 = read_mem(pc);
+
+#ifdef ENABLE_CORRUPTION
+	if (corrupt_chance) {
+	randcorrupt = (unsigned int)rand();
+	corrupt_now = ((unsigned int)rand() < corrupt_chance);
+	} else {randcorrupt = 0; corrupt_chance = 0;}
+#endif
+
+	++instructions_executed;
+
+	return opcode;
+}
+
+// The instruction handlers in run() are written with OP() and NEXT so that
+// they can be built in two ways:
+//
+//  - With THREADED_DISPATCH (the default), each handler ends with its own copy
+//    of the fetch code and jumps straight to the next handler through a table
+//    of label addresses (GCC's labels-as-values extension). This gives the
+//    branch predictor a separate indirect jump per opcode to learn from,
+//    rather than the single shared one in a switch. See
+//    http://eli.thegreenplace.net/2012/07/12/computed-goto-for-efficient-dispatch-tables/
+//    and https://www.cs.tcd.ie/David.Gregg/papers/toplas05.pdf.
+//
+//  - Without it, the handlers are the cases of a switch. Use this with
+//    compilers that lack labels-as-values, or to compare performance.
+
+#ifdef THREADED_DISPATCH
+
+// Pending events (and the debugger) are handled at the top of the loop in
+// run()
+#  define OP(name) op_##name:
+#  define NEXT              \
+	if (pending_event)        \
+		continue;             \
+	goto *dispatch_table[fetch_instruction()]
+
+// The dispatch table is indexed by opcode value, so check that
+// FOR_EACH_OPCODE lists every opcode in order
+#  define OPCODE_VALUE(name) name,
+static constexpr uint8_t opcodes_in_listed_order[] = { FOR_EACH_OPCODE(OPCODE_VALUE) };
+#  undef OPCODE_VALUE
+static constexpr bool opcodes_listed_in_order(unsigned i) {
+	return i == 256 ||
+	       (opcodes_in_listed_order[i] == i && opcodes_listed_in_order(i + 1));
+}
+static_assert(sizeof opcodes_in_listed_order == 256 && opcodes_listed_in_order(0),
+              "FOR_EACH_OPCODE must list all opcodes in order of value");
+
+#else
+
+#  define OP(name) case name:
+#  define NEXT break
+
+#endif
+
 void run() {
+#ifdef THREADED_DISPATCH
+#  define LABEL_ADDRESS(name) &&op_##name,
+	static void *const dispatch_table[] = { FOR_EACH_OPCODE(LABEL_ADDRESS) };
+#  undef LABEL_ADDRESS
+#endif
+
 	set_apu_cold_boot_state();
 	set_cpu_cold_boot_state();
 	set_ppu_cold_boot_state();
+	// Sets the initial PPU sync deadline
+	sync_ppu();
 
 	init_timing();
 
 	do_interrupt(Int_reset);
 
+	// Resume from a save state file if one was given
+	load_startup_state();
+
 	for (;;) {
 
 		if (pending_event) {
 			pending_event = false;
 			process_pending_events();
 
-			if (pending_end_emulation)
+			if (pending_end_emulation) {
+				stop_running_ahead();
 				break;
-		}
-
-		if (dbg_log_instruction())
-		{
-
-			uint8_t const opcode = read_mem(pc++);
-			if (polls_irq_after_first_cycle[opcode])
-				poll_for_interrupt();
-			op_1 = read_mem(pc);
+			}
 
-			// http://eli.thegreenplace.net/2012/07/12/computed-goto-for-efficient-dispatch-tables/
-			// could possibly speed this up a bit (also,
-			// https://www.cs.tcd.ie/David.Gregg/papers/toplas05.pdf). CPU
-			// emulation seems to account for less than 5% of the runtime though,
-			// so it might not be worth uglifying the code for
+			if (debugging && !run_debugger())
+				continue;
+		}
 
-#ifdef ENABLE_CORRUPTION
-			if (corrupt_chance) {
-			randcorrupt = (unsigned int)rand();
-			corrupt_now = ((unsigned int)rand() < corrupt_chance);
-			} else {randcorrupt = 0; corrupt_chance = 0;}
+#ifdef THREADED_DISPATCH
+		goto *dispatch_table[fetch_instruction()];
+#else
+		switch (fetch_instruction())
 #endif
+		{
 
-			switch (opcode) {
+			//
+			// Accumulator or implied addressing
+			//
 
-				//
-				// Accumulator or implied addressing
-				//
+			OP(BRK)
+				++pc;
+				do_interrupt(Int_BRK);
+				NEXT;
 
-				case BRK:
-					++pc;
-					do_interrupt(Int_BRK);
-					break;
+			OP(RTI)
+				read_tick(); // Corresponds to incrementing s
+				pull_flags();
+				pc = pull();
+				poll_for_interrupt();
+				pc |= pull() << 8;
+				NEXT;
 
-				case RTI:
+			OP(RTS)
+				{
 					read_tick(); // Corresponds to incrementing s
-					pull_flags();
-					pc = pull();
+					uint8_t const pc_low = pull();
+					pc = ((pull() << 8) | pc_low) + 1;
 					poll_for_interrupt();
-					pc |= pull() << 8;
-					break;
-
-				case RTS:
-					{
-						read_tick(); // Corresponds to incrementing s
-						uint8_t const pc_low = pull();
-						pc = ((pull() << 8) | pc_low) + 1;
-						poll_for_interrupt();
-						read_tick(); // Increment PC
-					}
-					break;
+					read_tick(); // Increment PC
+				}
+				NEXT;
 
-				case PHA:
-					poll_for_interrupt();
-					push(a);
-					break;
+			OP(PHA)
+				poll_for_interrupt();
+				push(a);
+				NEXT;
 
-				case PHP:
-					poll_for_interrupt();
-					push_flags(true);
-					break;
+			OP(PHP)
+				poll_for_interrupt();
+				push_flags(true);
+				NEXT;
 
-				case PLA:
-					read_tick(); // Corresponds to incrementing s
-					poll_for_interrupt();
-					zn = a = pull();
-					break;
+			OP(PLA)
+				read_tick(); // Corresponds to incrementing s
+				poll_for_interrupt();
+				zn = a = pull();
+				NEXT;
 
-				case PLP:
-					read_tick(); // Corresponds to incrementing s
-					poll_for_interrupt();
-					pull_flags();
-					break;
+			OP(PLP)
+				read_tick(); // Corresponds to incrementing s
+				poll_for_interrupt();
+				pull_flags();
+				NEXT;
 
-				case ASL_ACC: a = asl(a); break;
-				case LSR_ACC: a = lsr(a); break;
-				case ROL_ACC: a = rol(a); break;
-				case ROR_ACC: a = ror(a); break;
+			OP(ASL_ACC) a = asl(a); NEXT;
+			OP(LSR_ACC) a = lsr(a); NEXT;
+			OP(ROL_ACC) a = rol(a); NEXT;
+			OP(ROR_ACC) a = ror(a); NEXT;
 
 #ifdef ENABLE_CORRUPTION
-				case CLC: carry       = false ^ corrupt_now; break;
+			OP(CLC) carry       = false ^ corrupt_now; NEXT;
 #else
-				case CLC: carry       = false; break;
+			OP(CLC) carry       = false; NEXT;
 #endif
-				case CLD: decimal     = false; break;
-				case CLI: irq_disable = false; break;
-				case CLV: overflow    = false; break;
+			OP(CLD) decimal     = false; NEXT;
+			OP(CLI) irq_disable = false; NEXT;
+			OP(CLV) overflow    = false; NEXT;
 #ifdef ENABLE_CORRUPTION
-				case SEC: carry       = true ^ corrupt_now; break;
+			OP(SEC) carry       = true ^ corrupt_now; NEXT;
 #else
-				case SEC: carry       = true; break;
+			OP(SEC) carry       = true; NEXT;
 #endif
-				case SED: decimal     = true;  break;
-				case SEI: irq_disable = true;  break;
-
-				case DEX: zn = --x; break;
-				case DEY: zn = --y; break;
-				case INX: zn = ++x; break;
-				case INY: zn = ++y; break;
-
-				case TAX: zn = x = a; break;
-				case TAY: zn = y = a; break;
-				case TSX: zn = x = s; break;
-				case TXA: zn = a = x; break;
-				case TXS:      s = x; break;
-				case TYA: zn = a = y; break;
-
-					  // The "official" NOP and various unofficial NOPs with
-					  // accumulator/implied addressing
-				case NOP: case NO0: case NO1: case NO2: case NO3: case NO4: case NO5:
-					  break;
-
-					  //
-					  // Immediate addressing
-					  //
-
-				case ADC_IMM: adc(op_1);     ++pc; break;
-				case ALR_IMM: alr(op_1);     ++pc; break; // Unofficial
-				case AN0_IMM: anc(op_1);     ++pc; break; // Unofficial
-				case AN1_IMM: anc(op_1);     ++pc; break; // Unofficial
-				case AND_IMM: and_(op_1);    ++pc; break;
-				case ARR_IMM: arr(op_1);     ++pc; break; // Unofficial
-				case ATX_IMM: atx(op_1);     ++pc; break; // Unofficial
-				case AXS_IMM: axs(op_1);     ++pc; break; // Unofficial
-				case CMP_IMM: comp(a, op_1); ++pc; break;
-				case CPX_IMM: comp(x, op_1); ++pc; break;
-				case CPY_IMM: comp(y, op_1); ++pc; break;
-				case EOR_IMM: eor(op_1);     ++pc; break;
-				case LDA_IMM: lda(op_1);     ++pc; break;
-				case LDX_IMM: ldx(op_1);     ++pc; break;
-				case LDY_IMM: ldy(op_1);     ++pc; break;
-				case ORA_IMM: ora(op_1);     ++pc; break;
-				case SB2_IMM: // Unofficial, same as SBC
-				case SBC_IMM: sbc(op_1);     ++pc; break;
-				case XAA_IMM: xaa(op_1);     ++pc; break; // Unofficial
-
-					      // Unofficial NOPs with immediate addressing
-				case NO0_IMM: case NO1_IMM: case NO2_IMM: case NO3_IMM: case NO4_IMM:
-					      ++pc;
-					      break;
-
-					      //
-					      // Absolute addressing
-					      //
-
-				case JMP_ABS:
-					      poll_for_interrupt();
-					      pc = (read_mem(pc + 1) << 8) | op_1;
-					      break;
-
-				case JSR_ABS:
-					      ++pc;
-
-					      read_tick(); // Internal operation
-
-					      push(pc >> 8);
-					      push(pc & 0xFF);
-
-					      poll_for_interrupt();
-					      pc = (read_mem(pc) << 8) | op_1;
-					      break;
-
-					      // Read instructions
-
-				case ADC_ABS: adc(get_abs_op());     break;
-				case AND_ABS: and_(get_abs_op());    break;
-				case BIT_ABS: bit(get_abs_op());     break;
-				case CMP_ABS: comp(a, get_abs_op()); break;
-				case CPX_ABS: comp(x, get_abs_op()); break;
-				case CPY_ABS: comp(y, get_abs_op()); break;
-				case EOR_ABS: eor(get_abs_op());     break;
-				case LAX_ABS: lax(get_abs_op());     break; // Unofficial
-				case LDA_ABS: lda(get_abs_op());     break;
-				case LDX_ABS: ldx(get_abs_op());     break;
-				case LDY_ABS: ldy(get_abs_op());     break;
-				case ORA_ABS: ora(get_abs_op());     break;
-				case SBC_ABS: sbc(get_abs_op());     break;
-
-					      // Unofficial NOP with absolute addressing (acts like a read)
-				case NOP_ABS: get_abs_op(); break;
-
-					      // Read-modify-write instructions
-
-				case ASL_ABS: RMW(asl, get_abs_addr()); break;
-				case DCP_ABS: RMW(dcp, get_abs_addr()); break; // Unofficial
-				case DEC_ABS: RMW(dec, get_abs_addr()); break;
-				case INC_ABS: RMW(inc, get_abs_addr()); break;
-				case ISC_ABS: RMW(isc, get_abs_addr()); break; // Unofficial
-				case LSR_ABS: RMW(lsr, get_abs_addr()); break;
-				case RLA_ABS: RMW(rla, get_abs_addr()); break; // Unofficial
-				case RRA_ABS: RMW(rra, get_abs_addr()); break; // Unofficial
-				case ROL_ABS: RMW(rol, get_abs_addr()); break;
-				case ROR_ABS: RMW(ror, get_abs_addr()); break;
-				case SLO_ABS: RMW(slo, get_abs_addr()); break; // Unofficial
-				case SRE_ABS: RMW(sre, get_abs_addr()); break; // Unofficial
-
-					      // Write instructions
-
-				case SAX_ABS: abs_write(a & x); break; // Unofficial
-				case STA_ABS: abs_write(a);     break;
-				case STX_ABS: abs_write(x);     break;
-				case STY_ABS: abs_write(y);     break;
-
-					      //
-					      // Zero page addressing
-					      //
-
-					      // Read instructions
-
-				case ADC_ZERO: adc(get_zero_op());     break;
-				case AND_ZERO: and_(get_zero_op());    break;
-				case BIT_ZERO: bit(get_zero_op());     break;
-				case CMP_ZERO: comp(a, get_zero_op()); break;
-				case CPX_ZERO: comp(x, get_zero_op()); break;
-				case CPY_ZERO: comp(y, get_zero_op()); break;
-				case EOR_ZERO: eor(get_zero_op());     break;
-				case LAX_ZERO: lax(get_zero_op());     break; // Unofficial
-				case LDA_ZERO: lda(get_zero_op());     break;
-				case LDX_ZERO: ldx(get_zero_op());     break;
-				case LDY_ZERO: ldy(get_zero_op());     break;
-				case ORA_ZERO: ora(get_zero_op());     break;
-				case SBC_ZERO: sbc(get_zero_op());     break;
-
-					       // Read-modify-write instructions
-
-				case ASL_ZERO: ZERO_RMW(asl); break;
-				case DCP_ZERO: ZERO_RMW(dcp); break; // Unofficial
-				case DEC_ZERO: ZERO_RMW(dec); break;
-				case INC_ZERO: ZERO_RMW(inc); break;
-				case ISC_ZERO: ZERO_RMW(isc); break; // Unofficial
-				case LSR_ZERO: ZERO_RMW(lsr); break;
-				case RLA_ZERO: ZERO_RMW(rla); break; // Unofficial
-				case RRA_ZERO: ZERO_RMW(rra); break; // Unofficial
-				case ROL_ZERO: ZERO_RMW(rol); break;
-				case ROR_ZERO: ZERO_RMW(ror); break;
-				case SLO_ZERO: ZERO_RMW(slo); break; // Unofficial
-				case SRE_ZERO: ZERO_RMW(sre); break; // Unofficial
-
-					       // Write instructions
-
-				case SAX_ZERO: zero_write(a & x); break; // Unofficial
-				case STA_ZERO: zero_write(a);     break;
-				case STX_ZERO: zero_write(x);     break;
-				case STY_ZERO: zero_write(y);     break;
-
-					       // Unofficial NOPs with zero page addressing (acts like reads)
-				case NO0_ZERO: case NO1_ZERO: case NO2_ZERO:
-					       get_zero_op();
-					       break;
-
-					       //
-					       // Zero page indexed addressing
-					       //
-
-					       // Read instructions
-
-				case ADC_ZERO_X: adc(get_zero_xy_op(x));     break;
-				case AND_ZERO_X: and_(get_zero_xy_op(x));    break;
-				case CMP_ZERO_X: comp(a, get_zero_xy_op(x)); break;
-				case EOR_ZERO_X: eor(get_zero_xy_op(x));     break;
-				case LAX_ZERO_Y: lax(get_zero_xy_op(y));     break; // Unofficial
-				case LDA_ZERO_X: lda(get_zero_xy_op(x));     break;
-				case LDX_ZERO_Y: ldx(get_zero_xy_op(y));     break;
-				case LDY_ZERO_X: ldy(get_zero_xy_op(x));     break;
-				case ORA_ZERO_X: ora(get_zero_xy_op(x));     break;
-				case SBC_ZERO_X: sbc(get_zero_xy_op(x));     break;
-
-						 // Read-modify-write instructions
-
-				case ASL_ZERO_X: ZERO_X_RMW(asl); break;
-				case DCP_ZERO_X: ZERO_X_RMW(dcp); break; // Unofficial
-				case DEC_ZERO_X: ZERO_X_RMW(dec); break;
-				case INC_ZERO_X: ZERO_X_RMW(inc); break;
-				case ISC_ZERO_X: ZERO_X_RMW(isc); break; // Unofficial
-				case LSR_ZERO_X: ZERO_X_RMW(lsr); break;
-				case RLA_ZERO_X: ZERO_X_RMW(rla); break; // Unofficial
-				case RRA_ZERO_X: ZERO_X_RMW(rra); break; // Unofficial
-				case ROL_ZERO_X: ZERO_X_RMW(rol); break;
-				case ROR_ZERO_X: ZERO_X_RMW(ror); break;
-				case SLO_ZERO_X: ZERO_X_RMW(slo); break; // Unofficial
-				case SRE_ZERO_X: ZERO_X_RMW(sre); break; // Unofficial
-
-						 // Write instructions
-
-				case SAX_ZERO_Y: zero_xy_write(a & x, y); break; // Unofficial
-				case STA_ZERO_X: zero_xy_write(a, x);     break;
-				case STX_ZERO_Y: zero_xy_write(x, y);     break;
-				case STY_ZERO_X: zero_xy_write(y, x);     break;
-
-						 // Unofficial NOPs with indexed zero page addressing (acts like reads)
-				case NO0_ZERO_X: case NO1_ZERO_X: case NO2_ZERO_X: case NO3_ZERO_X:
-				case NO4_ZERO_X: case NO5_ZERO_X:
-						 get_zero_xy_op(x);
-						 break;
-
-						 //
-						 // Absolute indexed addressing
-						 //
-
-						 // Read instructions
-
-				case ADC_ABS_X: adc(get_abs_xy_op_read(x));     break;
-				case ADC_ABS_Y: adc(get_abs_xy_op_read(y));     break;
-				case AND_ABS_X: and_(get_abs_xy_op_read(x));    break;
-				case AND_ABS_Y: and_(get_abs_xy_op_read(y));    break;
-				case CMP_ABS_X: comp(a, get_abs_xy_op_read(x)); break;
-				case CMP_ABS_Y: comp(a, get_abs_xy_op_read(y)); break;
-				case EOR_ABS_X: eor(get_abs_xy_op_read(x));     break;
-				case EOR_ABS_Y: eor(get_abs_xy_op_read(y));     break;
-				case LAS_ABS_Y: las(get_abs_xy_op_read(y));     break; // Unofficial
-				case LAX_ABS_Y: lax(get_abs_xy_op_read(y));     break; // Unofficial
-				case LDA_ABS_X: lda(get_abs_xy_op_read(x));     break;
-				case LDA_ABS_Y: lda(get_abs_xy_op_read(y));     break;
-				case LDX_ABS_Y: ldx(get_abs_xy_op_read(y));     break;
-				case LDY_ABS_X: ldy(get_abs_xy_op_read(x));     break;
-				case ORA_ABS_X: ora(get_abs_xy_op_read(x));     break;
-				case ORA_ABS_Y: ora(get_abs_xy_op_read(y));     break;
-				case SBC_ABS_X: sbc(get_abs_xy_op_read(x));     break;
-				case SBC_ABS_Y: sbc(get_abs_xy_op_read(y));     break;
-
-						// Read-modify-write instructions
-
-				case ASL_ABS_X: RMW(asl, get_abs_xy_addr_write(x)); break;
-				case DCP_ABS_X: RMW(dcp, get_abs_xy_addr_write(x)); break; // Unofficial
-				case DCP_ABS_Y: RMW(dcp, get_abs_xy_addr_write(y)); break; // Unofficial
-				case DEC_ABS_X: RMW(dec, get_abs_xy_addr_write(x)); break;
-				case INC_ABS_X: RMW(inc, get_abs_xy_addr_write(x)); break;
-				case ISC_ABS_X: RMW(isc, get_abs_xy_addr_write(x)); break; // Unofficial
-				case ISC_ABS_Y: RMW(isc, get_abs_xy_addr_write(y)); break; // Unofficial
-				case LSR_ABS_X: RMW(lsr, get_abs_xy_addr_write(x)); break;
-				case RLA_ABS_X: RMW(rla, get_abs_xy_addr_write(x)); break; // Unofficial
-				case RLA_ABS_Y: RMW(rla, get_abs_xy_addr_write(y)); break; // Unofficial
-				case RRA_ABS_X: RMW(rra, get_abs_xy_addr_write(x)); break; // Unofficial
-				case RRA_ABS_Y: RMW(rra, get_abs_xy_addr_write(y)); break; // Unofficial
-				case ROL_ABS_X: RMW(rol, get_abs_xy_addr_write(x)); break;
-				case ROR_ABS_X: RMW(ror, get_abs_xy_addr_write(x)); break;
-				case SLO_ABS_X: RMW(slo, get_abs_xy_addr_write(x)); break; // Unofficial
-				case SLO_ABS_Y: RMW(slo, get_abs_xy_addr_write(y)); break; // Unofficial
-				case SRE_ABS_X: RMW(sre, get_abs_xy_addr_write(x)); break; // Unofficial
-				case SRE_ABS_Y: RMW(sre, get_abs_xy_addr_write(y)); break; // Unofficial
-
-						// Write instructions
-
-				case AXA_ABS_Y: unoff_addr_write(get_abs_addr(), a & x, y); break; // Unofficial
-				case SAY_ABS_X: unoff_addr_write(get_abs_addr(), y    , x); break; // Unofficial
-				case XAS_ABS_Y: unoff_addr_write(get_abs_addr(), x    , y); break; // Unofficial
-						// Unofficial
-				case TAS_ABS_Y:
-						s = a & x;
-						unoff_addr_write(get_abs_addr(), a & x, y);
-						break;
+			OP(SED) decimal     = true;  NEXT;
+			OP(SEI) irq_disable = true;  NEXT;
+
+			OP(DEX) zn = --x; NEXT;
+			OP(DEY) zn = --y; NEXT;
+			OP(INX) zn = ++x; NEXT;
+			OP(INY) zn = ++y; NEXT;
+
+			OP(TAX) zn = x = a; NEXT;
+			OP(TAY) zn = y = a; NEXT;
+			OP(TSX) zn = x = s; NEXT;
+			OP(TXA) zn = a = x; NEXT;
+			OP(TXS)      s = x; NEXT;
+			OP(TYA) zn = a = y; NEXT;
+
+				  // The "official" NOP and various unofficial NOPs with
+				  // accumulator/implied addressing
+			OP(NOP) OP(NO0) OP(NO1) OP(NO2) OP(NO3) OP(NO4) OP(NO5)
+				  NEXT;
+
+				  //
+				  // Immediate addressing
+				  //
+
+			OP(ADC_IMM) adc(op_1);     ++pc; NEXT;
+			OP(ALR_IMM) alr(op_1);     ++pc; NEXT; // Unofficial
+			OP(AN0_IMM) anc(op_1);     ++pc; NEXT; // Unofficial
+			OP(AN1_IMM) anc(op_1);     ++pc; NEXT; // Unofficial
+			OP(AND_IMM) and_(op_1);    ++pc; NEXT;
+			OP(ARR_IMM) arr(op_1);     ++pc; NEXT; // Unofficial
+			OP(ATX_IMM) atx(op_1);     ++pc; NEXT; // Unofficial
+			OP(AXS_IMM) axs(op_1);     ++pc; NEXT; // Unofficial
+			OP(CMP_IMM) comp(a, op_1); ++pc; NEXT;
+			OP(CPX_IMM) comp(x, op_1); ++pc; NEXT;
+			OP(CPY_IMM) comp(y, op_1); ++pc; NEXT;
+			OP(EOR_IMM) eor(op_1);     ++pc; NEXT;
+			OP(LDA_IMM) lda(op_1);     ++pc; NEXT;
+			OP(LDX_IMM) ldx(op_1);     ++pc; NEXT;
+			OP(LDY_IMM) ldy(op_1);     ++pc; NEXT;
+			OP(ORA_IMM) ora(op_1);     ++pc; NEXT;
+			OP(SB2_IMM) // Unofficial, same as SBC
+			OP(SBC_IMM) sbc(op_1);     ++pc; NEXT;
+			OP(XAA_IMM) xaa(op_1);     ++pc; NEXT; // Unofficial
+
+				      // Unofficial NOPs with immediate addressing
+			OP(NO0_IMM) OP(NO1_IMM) OP(NO2_IMM) OP(NO3_IMM) OP(NO4_IMM)
+				      ++pc;
+				      NEXT;
+
+				      //
+				      // Absolute addressing
+				      //
+
+			OP(JMP_ABS)
+				      poll_for_interrupt();
+				      pc = (read_mem(pc + 1) << 8) | op_1;
+				      NEXT;
+
+			OP(JSR_ABS)
+				      ++pc;
+
+				      read_tick(); // Internal operation
+
+				      push(pc >> 8);
+				      push(pc & 0xFF);
+
+				      poll_for_interrupt();
+				      pc = (read_mem(pc) << 8) | op_1;
+				      NEXT;
+
+				      // Read instructions
+
+			OP(ADC_ABS) adc(get_abs_op());     NEXT;
+			OP(AND_ABS) and_(get_abs_op());    NEXT;
+			OP(BIT_ABS) bit(get_abs_op());     NEXT;
+			OP(CMP_ABS) comp(a, get_abs_op()); NEXT;
+			OP(CPX_ABS) comp(x, get_abs_op()); NEXT;
+			OP(CPY_ABS) comp(y, get_abs_op()); NEXT;
+			OP(EOR_ABS) eor(get_abs_op());     NEXT;
+			OP(LAX_ABS) lax(get_abs_op());     NEXT; // Unofficial
+			OP(LDA_ABS) lda(get_abs_op());     NEXT;
+			OP(LDX_ABS) ldx(get_abs_op());     NEXT;
+			OP(LDY_ABS) ldy(get_abs_op());     NEXT;
+			OP(ORA_ABS) ora(get_abs_op());     NEXT;
+			OP(SBC_ABS) sbc(get_abs_op());     NEXT;
+
+				      // Unofficial NOP with absolute addressing (acts like a read)
+			OP(NOP_ABS) get_abs_op(); NEXT;
+
+				      // Read-modify-write instructions
+
+			OP(ASL_ABS) RMW(asl, get_abs_addr()); NEXT;
+			OP(DCP_ABS) RMW(dcp, get_abs_addr()); NEXT; // Unofficial
+			OP(DEC_ABS) RMW(dec, get_abs_addr()); NEXT;
+			OP(INC_ABS) RMW(inc, get_abs_addr()); NEXT;
+			OP(ISC_ABS) RMW(isc, get_abs_addr()); NEXT; // Unofficial
+			OP(LSR_ABS) RMW(lsr, get_abs_addr()); NEXT;
+			OP(RLA_ABS) RMW(rla, get_abs_addr()); NEXT; // Unofficial
+			OP(RRA_ABS) RMW(rra, get_abs_addr()); NEXT; // Unofficial
+			OP(ROL_ABS) RMW(rol, get_abs_addr()); NEXT;
+			OP(ROR_ABS) RMW(ror, get_abs_addr()); NEXT;
+			OP(SLO_ABS) RMW(slo, get_abs_addr()); NEXT; // Unofficial
+			OP(SRE_ABS) RMW(sre, get_abs_addr()); NEXT; // Unofficial
+
+				      // Write instructions
+
+			OP(SAX_ABS) abs_write(a & x); NEXT; // Unofficial
+			OP(STA_ABS) abs_write(a);     NEXT;
+			OP(STX_ABS) abs_write(x);     NEXT;
+			OP(STY_ABS) abs_write(y);     NEXT;
+
+				      //
+				      // Zero page addressing
+				      //
+
+				      // Read instructions
+
+			OP(ADC_ZERO) adc(get_zero_op());     NEXT;
+			OP(AND_ZERO) and_(get_zero_op());    NEXT;
+			OP(BIT_ZERO) bit(get_zero_op());     NEXT;
+			OP(CMP_ZERO) comp(a, get_zero_op()); NEXT;
+			OP(CPX_ZERO) comp(x, get_zero_op()); NEXT;
+			OP(CPY_ZERO) comp(y, get_zero_op()); NEXT;
+			OP(EOR_ZERO) eor(get_zero_op());     NEXT;
+			OP(LAX_ZERO) lax(get_zero_op());     NEXT; // Unofficial
+			OP(LDA_ZERO) lda(get_zero_op());     NEXT;
+			OP(LDX_ZERO) ldx(get_zero_op());     NEXT;
+			OP(LDY_ZERO) ldy(get_zero_op());     NEXT;
+			OP(ORA_ZERO) ora(get_zero_op());     NEXT;
+			OP(SBC_ZERO) sbc(get_zero_op());     NEXT;
+
+				       // Read-modify-write instructions
+
+			OP(ASL_ZERO) ZERO_RMW(asl); NEXT;
+			OP(DCP_ZERO) ZERO_RMW(dcp); NEXT; // Unofficial
+			OP(DEC_ZERO) ZERO_RMW(dec); NEXT;
+			OP(INC_ZERO) ZERO_RMW(inc); NEXT;
+			OP(ISC_ZERO) ZERO_RMW(isc); NEXT; // Unofficial
+			OP(LSR_ZERO) ZERO_RMW(lsr); NEXT;
+			OP(RLA_ZERO) ZERO_RMW(rla); NEXT; // Unofficial
+			OP(RRA_ZERO) ZERO_RMW(rra); NEXT; // Unofficial
+			OP(ROL_ZERO) ZERO_RMW(rol); NEXT;
+			OP(ROR_ZERO) ZERO_RMW(ror); NEXT;
+			OP(SLO_ZERO) ZERO_RMW(slo); NEXT; // Unofficial
+			OP(SRE_ZERO) ZERO_RMW(sre); NEXT; // Unofficial
+
+				       // Write instructions
+
+			OP(SAX_ZERO) zero_write(a & x); NEXT; // Unofficial
+			OP(STA_ZERO) zero_write(a);     NEXT;
+			OP(STX_ZERO) zero_write(x);     NEXT;
+			OP(STY_ZERO) zero_write(y);     NEXT;
+
+				       // Unofficial NOPs with zero page addressing (acts like reads)
+			OP(NO0_ZERO) OP(NO1_ZERO) OP(NO2_ZERO)
+				       get_zero_op();
+				       NEXT;
+
+				       //
+				       // Zero page indexed addressing
+				       //
+
+				       // Read instructions
+
+			OP(ADC_ZERO_X) adc(get_zero_xy_op(x));     NEXT;
+			OP(AND_ZERO_X) and_(get_zero_xy_op(x));    NEXT;
+			OP(CMP_ZERO_X) comp(a, get_zero_xy_op(x)); NEXT;
+			OP(EOR_ZERO_X) eor(get_zero_xy_op(x));     NEXT;
+			OP(LAX_ZERO_Y) lax(get_zero_xy_op(y));     NEXT; // Unofficial
+			OP(LDA_ZERO_X) lda(get_zero_xy_op(x));     NEXT;
+			OP(LDX_ZERO_Y) ldx(get_zero_xy_op(y));     NEXT;
+			OP(LDY_ZERO_X) ldy(get_zero_xy_op(x));     NEXT;
+			OP(ORA_ZERO_X) ora(get_zero_xy_op(x));     NEXT;
+			OP(SBC_ZERO_X) sbc(get_zero_xy_op(x));     NEXT;
+
+					 // Read-modify-write instructions
+
+			OP(ASL_ZERO_X) ZERO_X_RMW(asl); NEXT;
+			OP(DCP_ZERO_X) ZERO_X_RMW(dcp); NEXT; // Unofficial
+			OP(DEC_ZERO_X) ZERO_X_RMW(dec); NEXT;
+			OP(INC_ZERO_X) ZERO_X_RMW(inc); NEXT;
+			OP(ISC_ZERO_X) ZERO_X_RMW(isc); NEXT; // Unofficial
+			OP(LSR_ZERO_X) ZERO_X_RMW(lsr); NEXT;
+			OP(RLA_ZERO_X) ZERO_X_RMW(rla); NEXT; // Unofficial
+			OP(RRA_ZERO_X) ZERO_X_RMW(rra); NEXT; // Unofficial
+			OP(ROL_ZERO_X) ZERO_X_RMW(rol); NEXT;
+			OP(ROR_ZERO_X) ZERO_X_RMW(ror); NEXT;
+			OP(SLO_ZERO_X) ZERO_X_RMW(slo); NEXT; // Unofficial
+			OP(SRE_ZERO_X) ZERO_X_RMW(sre); NEXT; // Unofficial
+
+					 // Write instructions
+
+			OP(SAX_ZERO_Y) zero_xy_write(a & x, y); NEXT; // Unofficial
+			OP(STA_ZERO_X) zero_xy_write(a, x);     NEXT;
+			OP(STX_ZERO_Y) zero_xy_write(x, y);     NEXT;
+			OP(STY_ZERO_X) zero_xy_write(y, x);     NEXT;
+
+					 // Unofficial NOPs with indexed zero page addressing (acts like reads)
+			OP(NO0_ZERO_X) OP(NO1_ZERO_X) OP(NO2_ZERO_X) OP(NO3_ZERO_X)
+			OP(NO4_ZERO_X) OP(NO5_ZERO_X)
+					 get_zero_xy_op(x);
+					 NEXT;
+
+					 //
+					 // Absolute indexed addressing
+					 //
+
+					 // Read instructions
+
+			OP(ADC_ABS_X) adc(get_abs_xy_op_read(x));     NEXT;
+			OP(ADC_ABS_Y) adc(get_abs_xy_op_read(y));     NEXT;
+			OP(AND_ABS_X) and_(get_abs_xy_op_read(x));    NEXT;
+			OP(AND_ABS_Y) and_(get_abs_xy_op_read(y));    NEXT;
+			OP(CMP_ABS_X) comp(a, get_abs_xy_op_read(x)); NEXT;
+			OP(CMP_ABS_Y) comp(a, get_abs_xy_op_read(y)); NEXT;
+			OP(EOR_ABS_X) eor(get_abs_xy_op_read(x));     NEXT;
+			OP(EOR_ABS_Y) eor(get_abs_xy_op_read(y));     NEXT;
+			OP(LAS_ABS_Y) las(get_abs_xy_op_read(y));     NEXT; // Unofficial
+			OP(LAX_ABS_Y) lax(get_abs_xy_op_read(y));     NEXT; // Unofficial
+			OP(LDA_ABS_X) lda(get_abs_xy_op_read(x));     NEXT;
+			OP(LDA_ABS_Y) lda(get_abs_xy_op_read(y));     NEXT;
+			OP(LDX_ABS_Y) ldx(get_abs_xy_op_read(y));     NEXT;
+			OP(LDY_ABS_X) ldy(get_abs_xy_op_read(x));     NEXT;
+			OP(ORA_ABS_X) ora(get_abs_xy_op_read(x));     NEXT;
+			OP(ORA_ABS_Y) ora(get_abs_xy_op_read(y));     NEXT;
+			OP(SBC_ABS_X) sbc(get_abs_xy_op_read(x));     NEXT;
+			OP(SBC_ABS_Y) sbc(get_abs_xy_op_read(y));     NEXT;
+
+					// Read-modify-write instructions
+
+			OP(ASL_ABS_X) RMW(asl, get_abs_xy_addr_write(x)); NEXT;
+			OP(DCP_ABS_X) RMW(dcp, get_abs_xy_addr_write(x)); NEXT; // Unofficial
+			OP(DCP_ABS_Y) RMW(dcp, get_abs_xy_addr_write(y)); NEXT; // Unofficial
+			OP(DEC_ABS_X) RMW(dec, get_abs_xy_addr_write(x)); NEXT;
+			OP(INC_ABS_X) RMW(inc, get_abs_xy_addr_write(x)); NEXT;
+			OP(ISC_ABS_X) RMW(isc, get_abs_xy_addr_write(x)); NEXT; // Unofficial
+			OP(ISC_ABS_Y) RMW(isc, get_abs_xy_addr_write(y)); NEXT; // Unofficial
+			OP(LSR_ABS_X) RMW(lsr, get_abs_xy_addr_write(x)); NEXT;
+			OP(RLA_ABS_X) RMW(rla, get_abs_xy_addr_write(x)); NEXT; // Unofficial
+			OP(RLA_ABS_Y) RMW(rla, get_abs_xy_addr_write(y)); NEXT; // Unofficial
+			OP(RRA_ABS_X) RMW(rra, get_abs_xy_addr_write(x)); NEXT; // Unofficial
+			OP(RRA_ABS_Y) RMW(rra, get_abs_xy_addr_write(y)); NEXT; // Unofficial
+			OP(ROL_ABS_X) RMW(rol, get_abs_xy_addr_write(x)); NEXT;
+			OP(ROR_ABS_X) RMW(ror, get_abs_xy_addr_write(x)); NEXT;
+			OP(SLO_ABS_X) RMW(slo, get_abs_xy_addr_write(x)); NEXT; // Unofficial
+			OP(SLO_ABS_Y) RMW(slo, get_abs_xy_addr_write(y)); NEXT; // Unofficial
+			OP(SRE_ABS_X) RMW(sre, get_abs_xy_addr_write(x)); NEXT; // Unofficial
+			OP(SRE_ABS_Y) RMW(sre, get_abs_xy_addr_write(y)); NEXT; // Unofficial
+
+					// Write instructions
+
+			OP(AXA_ABS_Y) unoff_addr_write(get_abs_addr(), a & x, y); NEXT; // Unofficial
+			OP(SAY_ABS_X) unoff_addr_write(get_abs_addr(), y    , x); NEXT; // Unofficial
+			OP(XAS_ABS_Y) unoff_addr_write(get_abs_addr(), x    , y); NEXT; // Unofficial
+					// Unofficial
+			OP(TAS_ABS_Y)
+					s = a & x;
+					unoff_addr_write(get_abs_addr(), a & x, y);
+					NEXT;
+
+			OP(STA_ABS_X) abs_xy_write_a(x); NEXT;
+			OP(STA_ABS_Y) abs_xy_write_a(y); NEXT;
+
+					// Unofficial NOPs with absolute,x addressing (acts like reads)
+			OP(NO0_ABS_X) OP(NO1_ABS_X) OP(NO2_ABS_X) OP(NO3_ABS_X) OP(NO4_ABS_X)
+			OP(NO5_ABS_X)
+					get_abs_xy_op_read(x);
+					NEXT;
+
+					//
+					// Indexed indirect addressing
+					//
+
+					// Read instructions
+
+			OP(ADC_IND_X) adc(get_ind_x_op());     NEXT;
+			OP(AND_IND_X) and_(get_ind_x_op());    NEXT;
+			OP(CMP_IND_X) comp(a, get_ind_x_op()); NEXT;
+			OP(EOR_IND_X) eor(get_ind_x_op());     NEXT;
+			OP(LAX_IND_X) lax(get_ind_x_op());     NEXT; // Unofficial
+			OP(LDA_IND_X) lda(get_ind_x_op());     NEXT;
+			OP(ORA_IND_X) ora(get_ind_x_op());     NEXT;
+			OP(SBC_IND_X) sbc(get_ind_x_op());     NEXT;
+
+					// Write instructions
+
+			OP(SAX_IND_X) ind_x_write(a & x); NEXT; // Unofficial
+			OP(STA_IND_X) ind_x_write(a);     NEXT;
+
+					// Read-modify-write instructions
+
+			OP(DCP_IND_X) RMW(dcp, get_ind_x_addr()); NEXT; // Unofficial
+			OP(ISC_IND_X) RMW(isc, get_ind_x_addr()); NEXT; // Unofficial
+			OP(RLA_IND_X) RMW(rla, get_ind_x_addr()); NEXT; // Unofficial
+			OP(RRA_IND_X) RMW(rra, get_ind_x_addr()); NEXT; // Unofficial
+			OP(SLO_IND_X) RMW(slo, get_ind_x_addr()); NEXT; // Unofficial
+			OP(SRE_IND_X) RMW(sre, get_ind_x_addr()); NEXT; // Unofficial
+
+					//
+					// Indirect indexed addressing
+					//
+
+					// Read instructions
+
+			OP(ADC_IND_Y) adc(get_ind_y_op_read());     NEXT;
+			OP(AND_IND_Y) and_(get_ind_y_op_read());    NEXT;
+			OP(CMP_IND_Y) comp(a, get_ind_y_op_read()); NEXT;
+			OP(EOR_IND_Y) eor(get_ind_y_op_read());     NEXT;
+			OP(LAX_IND_Y) lax(get_ind_y_op_read());     NEXT; // Unofficial
+			OP(LDA_IND_Y) lda(get_ind_y_op_read());     NEXT;
+			OP(ORA_IND_Y) ora(get_ind_y_op_read());     NEXT;
+			OP(SBC_IND_Y) sbc(get_ind_y_op_read());     NEXT;
+
+					// Write instructions
+
+					// Unofficial
+			OP(AXA_IND_Y)
+					++pc;
+					read_tick(); // Fetch effective address low
+					read_tick(); // Fetch effective address high
+					unoff_addr_write(
+							(ram[(op_1 + 1) & 0xFF] << 8) | ram[op_1], // Address
+							a & x, y);
+					NEXT;
 
-				case STA_ABS_X: abs_xy_write_a(x); break;
-				case STA_ABS_Y: abs_xy_write_a(y); break;
+			OP(STA_IND_Y) ind_y_write_a(); NEXT;
 
-						// Unofficial NOPs with absolute,x addressing (acts like reads)
-				case NO0_ABS_X: case NO1_ABS_X: case NO2_ABS_X: case NO3_ABS_X: case NO4_ABS_X:
-				case NO5_ABS_X:
-						get_abs_xy_op_read(x);
-						break;
+					// Read-modify-write instructions
 
-						//
-						// Indexed indirect addressing
-						//
-
-						// Read instructions
-
-				case ADC_IND_X: adc(get_ind_x_op());     break;
-				case AND_IND_X: and_(get_ind_x_op());    break;
-				case CMP_IND_X: comp(a, get_ind_x_op()); break;
-				case EOR_IND_X: eor(get_ind_x_op());     break;
-				case LAX_IND_X: lax(get_ind_x_op());     break; // Unofficial
-				case LDA_IND_X: lda(get_ind_x_op());     break;
-				case ORA_IND_X: ora(get_ind_x_op());     break;
-				case SBC_IND_X: sbc(get_ind_x_op());     break;
-
-						// Write instructions
-
-				case SAX_IND_X: ind_x_write(a & x); break; // Unofficial
-				case STA_IND_X: ind_x_write(a);     break;
-
-						// Read-modify-write instructions
-
-				case DCP_IND_X: RMW(dcp, get_ind_x_addr()); break; // Unofficial
-				case ISC_IND_X: RMW(isc, get_ind_x_addr()); break; // Unofficial
-				case RLA_IND_X: RMW(rla, get_ind_x_addr()); break; // Unofficial
-				case RRA_IND_X: RMW(rra, get_ind_x_addr()); break; // Unofficial
-				case SLO_IND_X: RMW(slo, get_ind_x_addr()); break; // Unofficial
-				case SRE_IND_X: RMW(sre, get_ind_x_addr()); break; // Unofficial
-
-						//
-						// Indirect indexed addressing
-						//
-
-						// Read instructions
-
-				case ADC_IND_Y: adc(get_ind_y_op_read());     break;
-				case AND_IND_Y: and_(get_ind_y_op_read());    break;
-				case CMP_IND_Y: comp(a, get_ind_y_op_read()); break;
-				case EOR_IND_Y: eor(get_ind_y_op_read());     break;
-				case LAX_IND_Y: lax(get_ind_y_op_read());     break; // Unofficial
-				case LDA_IND_Y: lda(get_ind_y_op_read());     break;
-				case ORA_IND_Y: ora(get_ind_y_op_read());     break;
-				case SBC_IND_Y: sbc(get_ind_y_op_read());     break;
-
-						// Write instructions
-
-						// Unofficial
-				case AXA_IND_Y:
-						++pc;
-						read_tick(); // Fetch effective address low
-						read_tick(); // Fetch effective address high
-						unoff_addr_write(
-								(ram[(op_1 + 1) & 0xFF] << 8) | ram[op_1], // Address
-								a & x, y);
-						break;
+			OP(DCP_IND_Y) RMW(dcp, get_ind_y_addr_write()); NEXT; // Unofficial
+			OP(ISC_IND_Y) RMW(isc, get_ind_y_addr_write()); NEXT; // Unofficial
+			OP(RLA_IND_Y) RMW(rla, get_ind_y_addr_write()); NEXT; // Unofficial
+			OP(RRA_IND_Y) RMW(rra, get_ind_y_addr_write()); NEXT; // Unofficial
+			OP(SLO_IND_Y) RMW(slo, get_ind_y_addr_write()); NEXT; // Unofficial
+			OP(SRE_IND_Y) RMW(sre, get_ind_y_addr_write()); NEXT; // Unofficial
 
-				case STA_IND_Y: ind_y_write_a(); break;
-
-						// Read-modify-write instructions
-
-				case DCP_IND_Y: RMW(dcp, get_ind_y_addr_write()); break; // Unofficial
-				case ISC_IND_Y: RMW(isc, get_ind_y_addr_write()); break; // Unofficial
-				case RLA_IND_Y: RMW(rla, get_ind_y_addr_write()); break; // Unofficial
-				case RRA_IND_Y: RMW(rra, get_ind_y_addr_write()); break; // Unofficial
-				case SLO_IND_Y: RMW(slo, get_ind_y_addr_write()); break; // Unofficial
-				case SRE_IND_Y: RMW(sre, get_ind_y_addr_write()); break; // Unofficial
-
-						//
-						// Indirect addressing
-						//
-
-				case JMP_IND:
-						{
-							uint16_t const addr = (read_mem(pc + 1) << 8) | op_1;
-							pc = read_mem(addr);
-							poll_for_interrupt();
-							pc |= read_mem((addr & 0xFF00) | ((addr + 1) & 0xFF)) << 8;
-							break;
-						}
-
-						//
-						// Branch instructions
-						//
-
-				case BCC: branch_if(!carry);        break;
-				case BCS: branch_if(carry);         break;
-				case BVC: branch_if(!overflow);     break;
-				case BVS: branch_if(overflow);      break;
-				case BEQ: branch_if(!(zn & 0xFF));  break;
-				case BMI: branch_if(zn & 0x180);    break;
-				case BNE: branch_if(zn & 0xFF);     break;
-				case BPL: branch_if(!(zn & 0x180)); break;
-
-					  //
-					  // KIL instructions (hang the CPU)
-					  //
-
-				case KI0: case KI1: case KI2: case KI3: case KI4: case KI5:
-				case KI6: case KI7: case KI8: case KI9: case K10: case K11:
+					//
+					// Indirect addressing
+					//
+
+			OP(JMP_IND)
+					{
+						uint16_t const addr = (read_mem(pc + 1) << 8) | op_1;
+						pc = read_mem(addr);
+						poll_for_interrupt();
+						pc |= read_mem((addr & 0xFF00) | ((addr + 1) & 0xFF)) << 8;
+						NEXT;
+					}
+
+					//
+					// Branch instructions
+					//
+
+			OP(BCC) branch_if(!carry);        NEXT;
+			OP(BCS) branch_if(carry);         NEXT;
+			OP(BVC) branch_if(!overflow);     NEXT;
+			OP(BVS) branch_if(overflow);      NEXT;
+			OP(BEQ) branch_if(!(zn & 0xFF));  NEXT;
+			OP(BMI) branch_if(zn & 0x180);    NEXT;
+			OP(BNE) branch_if(zn & 0xFF);     NEXT;
+			OP(BPL) branch_if(!(zn & 0x180)); NEXT;
+
+				  //
+				  // KIL instructions (hang the CPU)
+				  //
+
+			OP(KI0) OP(KI1) OP(KI2) OP(KI3) OP(KI4) OP(KI5)
+			OP(KI6) OP(KI7) OP(KI8) OP(KI9) OP(K10) OP(K11)
 #ifdef ENABLE_CORRUPTION
-					  if (!corrupt_chance) { //the user wants corruptions, not resettions.
+				  if (!corrupt_chance) { //the user wants corruptions, not resettions.
 #endif
-						  reset_cpu(); 
-						  puts("KIL instruction executed, system hung. Resetting.");
+					  reset_cpu(); 
+					  puts("KIL instruction executed, system hung. Resetting.");
 #ifdef ENABLE_CORRUPTION
-					  }
+				  }
 #endif
-					  //end_emulation();
-					  //exit_sdl_thread();
-			}
-		} else {
-			sleep_till_end_of_frame();
-			draw_frame();
-			handle_ui_keys();
+				  //end_emulation();
+				  //exit_sdl_thread();
 		}
 	}
 }
@@ -1355,6 +1631,11 @@ void run() {
 
 static void set_cpu_cold_boot_state() {
 	init_array(ram, (uint8_t)0xFF);
+	// Internal RAM is mirrored four times in $0000-$1FFF. PRG is mapped by
+	// the mapper, via the set_prg_*_bank() functions.
+	for (unsigned i = 0; i < 4; ++i)
+		map_cpu_mem(0x800*i, 0x800, ram, ram_dirty);
+	map_cpu_mem(0x6000, 0x2000, wram_6000_page, wram_dirty_flags(wram_6000_page));
 	cpu_data_bus = 0;
 #ifdef ENABLE_CORRUPTION
 	corrupt_chance = 0;
@@ -1371,14 +1652,20 @@ static void set_cpu_cold_boot_state() {
 
 	pending_event         = false;
 	pending_end_emulation = false;
+	run_ahead_left        = 0;
+	will_run_ahead        = false;
 	irq_line              = pending_irq = cart_irq = false;
 	nmi_asserted          = pending_nmi = false;
 
 	cpu_is_reading = true;
 
 	pal_extra_tick = 5;
+	pending_ppu_ticks = 0;
+
+	instructions_executed = 0;
 
 	reset_debugger();
+	debugging = debugger_active();
 }
 
 static void reset_cpu() {
@@ -1394,8 +1681,8 @@ static void reset_cpu() {
 
 template<bool calculating_size, bool is_save>
 void transfer_cpu_state(uint8_t *&buf) {
-	TRANSFER(ram)
-		if (wram_base) TRANSFER_P(wram_base, 0x2000*wram_8k_banks)
+	TRANSFER_TRACKED(ram, ram_dirty, sizeof ram)
+		if (wram_base) TRANSFER_TRACKED(wram_base, wram_dirty, 0x2000*wram_8k_banks)
 			TRANSFER(pc)
 				TRANSFER(a) TRANSFER(s) TRANSFER(x) TRANSFER(y)
 				TRANSFER(zn) TRANSFER(carry) TRANSFER(irq_disable) TRANSFER(decimal)
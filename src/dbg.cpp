@@ -30,6 +30,7 @@ static uint8_t mem_insert_byte = 0x0;
 int set_debugger_vis(bool vis) {
   if (vis) {
     if (!debugger_on) cursor_cpu = pc;
+    debugger_opened();
   }else {
   }
 
@@ -123,6 +124,7 @@ static unsigned n_breakpoints_set;
 
 int reset_debugger(void) {
   init_array(breakpoint_at, false);
+  n_breakpoints_set = 0;
   return 0;
 }
 
@@ -958,6 +960,10 @@ void dbg_redraw_mem() {
   }
 }
 
+bool debugger_active(void) {
+  return show_debugger || debug_mode != RUN || n_breakpoints_set > 0;
+}
+
 int dbg_log_instruction() {
 
   if (debug_mode == NEXT_STEP) { set_debug_mode(SINGLE_STEP); cursor_cpu = pc; }
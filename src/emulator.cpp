@@ -0,0 +1,59 @@
+#include "common.h"
+
+#include "cpu.h"
+#include "emulator.h"
+#include "headless.h"
+#include "mapper.h"
+#include "rom.h"
+#include "sdl_backend.h"
+
+Emulator::Emulator(char const *rom_filename, unsigned long n_frames)
+  : rom_filename(rom_filename), n_frames(n_frames), started(false),
+    n_frames_run(0), n_audio_samples(0), n_instructions(0), cpu_seconds(0),
+    frame(0) {}
+
+Emulator::~Emulator() {
+    if (started)
+        wait();
+    free_array_set_null(frame);
+}
+
+void Emulator::start() {
+    assert(!started);
+    int const res = pthread_create(&thread, 0, emulation_thread, this);
+    errno_val_fail_if(res != 0, res, "failed to create emulation thread for '%s'",
+                      rom_filename);
+    started = true;
+}
+
+void Emulator::wait() {
+    if (!started)
+        return;
+    int const res = pthread_join(thread, 0);
+    errno_val_fail_if(res != 0, res, "failed to join emulation thread for '%s'",
+                      rom_filename);
+    started = false;
+}
+
+// Runs with a fresh copy of all emulation state. Results are copied out
+// before returning, as the thread-local state disappears with the thread.
+void *Emulator::emulation_thread(void *emulator) {
+    Emulator &e = *static_cast<Emulator*>(emulator);
+
+    headless_frame_limit = e.n_frames;
+    load_rom(e.rom_filename, false);
+    run();
+
+    e.n_frames_run    = headless_frames_run;
+    e.n_audio_samples = headless_audio_samples_received;
+    e.n_instructions  = instructions_executed;
+    e.cpu_seconds     = headless_cpu_time();
+    if (!e.frame)
+        fail_if(!(e.frame = new (std::nothrow) uint32_t[NES_PPU_W*NES_PPU_H]),
+                "failed to allocate frame buffer for '%s'", e.rom_filename);
+    memcpy(e.frame, completed_frame(), sizeof(uint32_t)*NES_PPU_W*NES_PPU_H);
+
+    unload_rom();
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "common.h"
+
+#include "cpu.h"
+#include "headless.h"
+#include "md5.h"
+#include "sdl_backend.h"
+
+#ifndef HEADLESS
+bool headless;
+#endif
+
+EMU_STATE unsigned long headless_frame_limit;
+EMU_STATE unsigned long headless_frames_run;
+EMU_STATE unsigned long long headless_audio_samples_received;
+
+//
+// Frame hashes
+//
+
+static EMU_STATE FILE *hash_file;
+static EMU_STATE char const *hash_filename;
+static EMU_STATE unsigned hash_interval;
+// Hash of the audio since the last line was written
+static EMU_STATE MD5_CTX audio_md5_ctx;
+// Frame number of the last line written
+static EMU_STATE unsigned long last_hashed_frame;
+
+void start_frame_hashes(char const *filename, unsigned interval) {
+    assert(interval > 0);
+
+    errno_fail_if(!(hash_file = fopen(filename, "w")),
+                  "failed to open '%s' for writing frame hashes", filename);
+    hash_filename = filename;
+    hash_interval = interval;
+    last_hashed_frame = 0;
+    MD5_Init(&audio_md5_ctx);
+}
+
+static void write_digest(MD5_CTX *ctx) {
+    uint8_t digest[16];
+    MD5_Final(digest, ctx);
+    for (unsigned i = 0; i < 16; ++i)
+        fprintf(hash_file, "%02x", digest[i]);
+}
+
+// Writes a line with the hash of the most recently completed frame and of the
+// audio since the last line
+static void write_frame_hash() {
+    static EMU_STATE MD5_CTX video_md5_ctx;
+
+    MD5_Init(&video_md5_ctx);
+    MD5_Update(&video_md5_ctx, (void*)completed_frame(),
+               sizeof(uint32_t)*NES_PPU_W*NES_PPU_H);
+
+    fprintf(hash_file, "%lu ", headless_frames_run);
+    write_digest(&video_md5_ctx);
+    fputc(' ', hash_file);
+    write_digest(&audio_md5_ctx);
+    fputc('\n', hash_file);
+
+    MD5_Init(&audio_md5_ctx);
+    last_hashed_frame = headless_frames_run;
+}
+
+void end_frame_hashes() {
+    if (!hash_file)
+        return;
+
+    // Cover the frames after the last full interval too
+    if (last_hashed_frame != headless_frames_run)
+        write_frame_hash();
+
+    errno_fail_if(fflush(hash_file) == EOF || ferror(hash_file),
+                  "failed to write frame hashes to '%s'", hash_filename);
+    errno_fail_if(fclose(hash_file) == EOF, "failed to close '%s'", hash_filename);
+    hash_file = 0;
+}
+
+void headless_end_of_frame() {
+    ++headless_frames_run;
+    if (hash_file && headless_frames_run % hash_interval == 0)
+        write_frame_hash();
+    if (headless_frame_limit != 0 && headless_frames_run >= headless_frame_limit)
+        end_emulation();
+}
+
+bool headless_video_needed() {
+    unsigned long const next_frame = headless_frames_run + 1;
+
+    // Without a frame limit, any frame could turn out to be the last one
+    if (headless_frame_limit == 0 || next_frame == headless_frame_limit)
+        return true;
+    return hash_file && next_frame % hash_interval == 0;
+}
+
+void headless_audio_samples(int16_t const *samples, size_t len) {
+    headless_audio_samples_received += len;
+    if (hash_file)
+        MD5_Update(&audio_md5_ctx, (void*)samples, sizeof(int16_t)*len);
+}
+
+double headless_cpu_time() {
+    timespec ts;
+    errno_fail_if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1,
+                  "failed to get thread CPU time from clock_gettime()");
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+void report_headless_run() {
+    double const cpu_time = headless_cpu_time();
+    printf("Ran %lu frames (%llu audio samples, %llu instructions) in %.2f s "
+           "of CPU time (%.0f instructions/s)\n",
+           headless_frames_run, headless_audio_samples_received,
+           instructions_executed, cpu_time, instructions_executed/cpu_time);
+}
@@ -0,0 +1,71 @@
+// Backend used in HEADLESS=1 builds. Implements the interface in sdl_backend.h
+// without SDL: frames are kept in memory, audio goes to the sink in
+// headless.h, and there is no input.
+#include "common.h"
+
+#include "dbg.h"
+#include "sdl_backend.h"
+
+//
+// Video
+//
+
+static EMU_STATE uint32_t render_buffers[2][NES_PPU_H*NES_PPU_W];
+// Index of the buffer being drawn into. The other buffer holds the most
+// recently completed frame. (Indices rather than pointers since the address of
+// a thread-local variable isn't a constant expression.)
+static EMU_STATE unsigned back_buffer_i;
+
+void put_pixel(int x, unsigned y, uint32_t color) {
+    assert(x >= -NES_PPU_OFFSET);
+    assert(x < (NES_PPU_W - NES_PPU_OFFSET));
+    assert(y < NES_PPU_H);
+
+    render_buffers[back_buffer_i][NES_PPU_W*y + (x + NES_PPU_OFFSET)] = color;
+}
+
+void put_pixels(int x, unsigned y, uint32_t const *colors, unsigned n) {
+    assert(x >= -NES_PPU_OFFSET);
+    assert(x + n <= (unsigned)(NES_PPU_W - NES_PPU_OFFSET));
+    assert(y < NES_PPU_H);
+
+    memcpy(render_buffers[back_buffer_i] + NES_PPU_W*y + (x + NES_PPU_OFFSET), colors,
+           sizeof(uint32_t)*n);
+}
+
+void draw_frame() {
+    back_buffer_i ^= 1;
+}
+
+uint32_t const *completed_frame() {
+    return render_buffers[back_buffer_i ^ 1];
+}
+
+//
+// Audio
+//
+
+// end_audio_frame() hands samples directly to headless_audio_samples(), so
+// there's no device to pause
+
+int audio_pause(bool) { return 1; }
+
+//
+// Input and events
+//
+
+EMU_STATE bool controller_inputs[4][I_COUNT];
+EMU_STATE bool global_inputs[IG_COUNT];
+
+void handle_ui_keys() {}
+
+void exit_sdl_thread() {}
+
+//
+// Debugger (dbg.cpp depends on SDL and isn't built)
+//
+
+int reset_debugger() { return 0; }
+int set_debugger_vis(bool) { return 0; }
+int dbg_log_instruction() { return 1; }
+bool debugger_active() { return false; }
@@ -1,16 +1,21 @@
 #include "common.h"
 
+#include "headless.h"
+#include "input.h"
+#include "replay.h"
 #include "sdl_backend.h"
 
 // The input routines are still tied to SDL
-#include <SDL.h>
+#ifndef HEADLESS
+#  include <SDL.h>
+#endif
 
 // If true, prevent the game from seeing left+right or up+down pressed
 // simultaneously, which glitches out some games. When both keys are pressed at
 // the same time, pretend only the key most recently pressed is pressed.
 bool const prevent_simul_left_right_or_up_down = true;
 
-static struct Controller_data {
+static EMU_STATE struct Controller_data {
     // Button states
     bool left_pushed, right_pushed, up_pushed, down_pushed,
          a_pushed, b_pushed, start_pushed, select_pushed;
@@ -23,7 +28,7 @@ static struct Controller_data {
     //unsigned key_a, key_b, key_select, key_start, key_up, key_down, key_left, key_right;
 } controller_data[2];
 
-bool reset_pushed;
+EMU_STATE bool reset_pushed;
 
 void init_input() {
     // Currently hardcoded
@@ -47,8 +52,13 @@ void init_input() {
     //controller_data[1].key_right  = SDL_SCANCODE_RIGHT;
 }
 
-void calc_controller_state() {
-    SDL_LockMutex(event_lock);
+// Reads the button states from the SDL thread
+static void read_live_inputs() {
+    // There's no SDL thread (and no event lock) in headless mode
+#ifndef HEADLESS
+    if (!headless)
+        SDL_LockMutex(event_lock);
+#endif
 
     for (unsigned i = 0; i < 2; ++i) {
         Controller_data &c = controller_data[i];
@@ -105,7 +115,33 @@ void calc_controller_state() {
 
     reset_pushed = global_inputs[IG_RESET];
 
-    SDL_UnlockMutex(event_lock);
+#ifndef HEADLESS
+    if (!headless)
+        SDL_UnlockMutex(event_lock);
+#endif
+}
+
+static void set_button_states(unsigned n, uint8_t buttons) {
+    Controller_data &c = controller_data[n];
+    c.right_pushed  = buttons & 0x80;
+    c.left_pushed   = buttons & 0x40;
+    c.down_pushed   = buttons & 0x20;
+    c.up_pushed     = buttons & 0x10;
+    c.start_pushed  = buttons & 0x08;
+    c.select_pushed = buttons & 0x04;
+    c.b_pushed      = buttons & 0x02;
+    c.a_pushed      = buttons & 0x01;
+}
+
+void calc_controller_state() {
+    read_live_inputs();
+
+    if (replay_mode != REPLAY_NONE) {
+        uint8_t buttons[2] = { get_button_states(0), get_button_states(1) };
+        replay_frame(buttons, reset_pushed);
+        set_button_states(0, buttons[0]);
+        set_button_states(1, buttons[1]);
+    }
 }
 
 uint8_t get_button_states(unsigned n) {
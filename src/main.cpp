@@ -1,22 +1,65 @@
 #include "common.h"
 
 #include "apu.h"
+#include "benchmark.h"
+#include "compose.h"
 #include "cpu.h"
+#ifdef HEADLESS
+#  include "emulator.h"
+#endif
+#include "headless.h"
 #include "input.h"
 #include "mapper.h"
+#include "metrics.h"
+#include "replay.h"
 #include "rom.h"
+#include "save_states.h"
 #include "sdl_backend.h"
 #ifdef RUN_TESTS
 #  include "test.h"
 #endif
+#include "timing.h"
 
-#include <SDL.h>
+#ifndef HEADLESS
+#  include <SDL.h>
+#endif
 
 char const *program_name;
 
+#ifndef RUN_TESTS
+// Save state files to load before starting and to save after finishing
+static char const *load_state_filename;
+static char const *save_state_filename;
+// Input logs to record to or play back from
+static char const *record_input_filename;
+static char const *play_input_filename;
+// File to write frame hashes to in headless mode, and the number of frames
+// between hashes
+static char const *frame_hashes_filename;
+static unsigned hash_interval = 60;
+// ROM and number of frames for --benchmark
+static char const *benchmark_rom;
+static unsigned long benchmark_frames;
+// File to write metrics to, and the number of seconds between writes
+static char const *metrics_filename;
+static unsigned metrics_interval = 10;
+// Set if --rewind or --autosave was given. They set EMU_STATE variables, which
+// are thread-local in headless builds.
+static bool rewind_set, autosave_set;
+#endif
+
+#ifndef HEADLESS
+// Print frame pacing statistics at exit (--pacing-stats)
+static bool print_pacing_stats;
+#endif
+
+#ifdef RUN_TESTS
+static bool tests_passed;
+#endif
+
 static int emulation_thread(void*) {
 #ifdef RUN_TESTS
-    run_tests();
+    tests_passed = run_tests();
 #else
     run();
 #endif
@@ -24,42 +67,267 @@ static int emulation_thread(void*) {
     return 0;
 }
 
+static void print_usage_and_exit() {
+#if defined(RUN_TESTS)
+    fprintf(stderr, "usage: %s [--headless]\n", program_name);
+#elif defined(HEADLESS)
+    fprintf(stderr, "usage: %s [--headless] [--frames <n>] [--load-state <file>] "
+                    "[--save-state <file>] [--autosave <seconds>] "
+                    "[--record-input <file> | --play-input <file>] "
+                    "[--frame-hashes <file> [--hash-interval <n>]] "
+                    "[--metrics <file> [--metrics-interval <seconds>]] <rom file> [<rom file> ...]\n"
+                    "       %s [--rewind <MiB>] --benchmark <rom file> <frames>\n",
+            program_name, program_name);
+#else
+    fprintf(stderr, "usage: %s [--headless] [--frames <n>] [--rewind <MiB>] [--load-state <file>] "
+                    "[--save-state <file>] [--autosave <seconds>] [--fast-forward-speed <n>] "
+                    "[--run-ahead <frames>] [--sync-to-display] [--pacing-stats] "
+                    "[--record-input <file> | --play-input <file>] "
+                    "[--frame-hashes <file> [--hash-interval <n>]] "
+                    "[--metrics <file> [--metrics-interval <seconds>]] <rom file>\n"
+                    "       %s [--rewind <MiB>] --benchmark <rom file> <frames>\n",
+            program_name, program_name);
+#endif
+    exit(EXIT_FAILURE);
+}
+
+// Parses command-line options and returns the index of the first non-option
+// argument
+static int parse_options(int argc, char *argv[]) {
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+        if (!strcmp(argv[i], "--headless")) {
+#ifndef HEADLESS
+            headless = true;
+#endif
+        }
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            char *end;
+            headless_frame_limit = strtoul(argv[++i], &end, 10);
+            if (*end != '\0')
+                print_usage_and_exit();
+        }
+        else if (!strcmp(argv[i], "--rewind") && i + 1 < argc) {
+            char *end;
+            set_rewind_budget_mb(strtoul(argv[++i], &end, 10));
+            if (*end != '\0')
+                print_usage_and_exit();
+#ifndef RUN_TESTS
+            rewind_set = true;
+#endif
+        }
+#ifndef RUN_TESTS
+        else if (!strcmp(argv[i], "--load-state") && i + 1 < argc)
+            load_state_filename = argv[++i];
+        else if (!strcmp(argv[i], "--save-state") && i + 1 < argc)
+            save_state_filename = argv[++i];
+        else if (!strcmp(argv[i], "--autosave") && i + 1 < argc) {
+            char *end;
+            set_autosave_interval(strtoul(argv[++i], &end, 10));
+            if (*end != '\0')
+                print_usage_and_exit();
+            autosave_set = true;
+        }
+#  ifndef HEADLESS
+        else if (!strcmp(argv[i], "--fast-forward-speed") && i + 1 < argc) {
+            char *end;
+            fast_forward_speed = strtoul(argv[++i], &end, 10);
+            if (*end != '\0')
+                print_usage_and_exit();
+        }
+        else if (!strcmp(argv[i], "--run-ahead") && i + 1 < argc) {
+            char *end;
+            run_ahead_frames = strtoul(argv[++i], &end, 10);
+            if (*end != '\0')
+                print_usage_and_exit();
+        }
+        else if (!strcmp(argv[i], "--sync-to-display"))
+            sync_to_display = true;
+        else if (!strcmp(argv[i], "--pacing-stats"))
+            print_pacing_stats = true;
+#  endif
+        else if (!strcmp(argv[i], "--record-input") && i + 1 < argc)
+            record_input_filename = argv[++i];
+        else if (!strcmp(argv[i], "--play-input") && i + 1 < argc)
+            play_input_filename = argv[++i];
+        else if (!strcmp(argv[i], "--frame-hashes") && i + 1 < argc)
+            frame_hashes_filename = argv[++i];
+        else if (!strcmp(argv[i], "--hash-interval") && i + 1 < argc) {
+            char *end;
+            hash_interval = strtoul(argv[++i], &end, 10);
+            if (*end != '\0' || hash_interval == 0)
+                print_usage_and_exit();
+        }
+        else if (!strcmp(argv[i], "--metrics") && i + 1 < argc)
+            metrics_filename = argv[++i];
+        else if (!strcmp(argv[i], "--metrics-interval") && i + 1 < argc) {
+            char *end;
+            metrics_interval = strtoul(argv[++i], &end, 10);
+            if (*end != '\0' || metrics_interval == 0)
+                print_usage_and_exit();
+        }
+        else if (!strcmp(argv[i], "--benchmark") && i + 2 < argc) {
+            benchmark_rom = argv[++i];
+            char *end;
+            benchmark_frames = strtoul(argv[++i], &end, 10);
+            if (*end != '\0' || benchmark_frames == 0)
+                print_usage_and_exit();
+        }
+#endif
+        else
+            print_usage_and_exit();
+    }
+
+    return i;
+}
+
+#if defined(HEADLESS) && !defined(RUN_TESTS)
+// Runs each ROM in 'roms' on a separate thread and prints the results in
+// order once all of them have finished
+static void run_in_parallel(char *roms[], unsigned n_roms) {
+    Emulator **emulators = new Emulator*[n_roms];
+    for (unsigned i = 0; i < n_roms; ++i) {
+        emulators[i] = new Emulator(roms[i], headless_frame_limit);
+        emulators[i]->start();
+    }
+
+    for (unsigned i = 0; i < n_roms; ++i) {
+        emulators[i]->wait();
+        Emulator const &e = *emulators[i];
+        printf("%s: ran %lu frames (%llu audio samples, %llu instructions) in "
+               "%.2f s of CPU time (%.0f instructions/s)\n",
+               e.rom(), e.frames_run(), e.audio_samples(), e.instructions(),
+               e.cpu_time(), e.instructions()/e.cpu_time());
+        delete emulators[i];
+    }
+
+    delete [] emulators;
+}
+#endif
+
 int main(int argc, char *argv[]) {
     program_name = argv[0] ? argv[0] : "nesalizer";
+
+    int const first_arg = parse_options(argc, argv);
 #ifndef RUN_TESTS
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <rom file>\n", program_name);
-        exit(EXIT_FAILURE);
-    }
+    // The ROM is given as part of --benchmark
+    if (benchmark_rom && argc - first_arg != 0)
+        print_usage_and_exit();
+    // Benchmarks always run from power-on without input for the given number
+    // of frames, and only --rewind applies to them. Reject options that would
+    // otherwise be silently ignored.
+    if (benchmark_rom &&
+        (headless_frame_limit != 0 || record_input_filename || play_input_filename ||
+         frame_hashes_filename || metrics_filename || load_state_filename ||
+         save_state_filename || autosave_set))
+        print_usage_and_exit();
+#endif
+#if defined(HEADLESS) && !defined(RUN_TESTS)
+    if (argc - first_arg < 1 && !benchmark_rom)
+        print_usage_and_exit();
+    // Input logs, frame hashes, metrics, save states, and rewind and autosave
+    // settings are only supported with a single ROM. The settings apply to
+    // this thread only, and not to the threads run_in_parallel() creates.
+    if ((record_input_filename || play_input_filename || frame_hashes_filename ||
+         metrics_filename || load_state_filename || save_state_filename ||
+         rewind_set || autosave_set) &&
+        argc - first_arg > 1)
+        print_usage_and_exit();
+#elif !defined(RUN_TESTS)
+    if (argc - first_arg != 1 && !benchmark_rom)
+        print_usage_and_exit();
 #else
-    (void)argc; // Suppress warning
+    if (argc - first_arg != 0)
+        print_usage_and_exit();
+#endif
+#ifndef RUN_TESTS
+    if (record_input_filename && play_input_filename)
+        print_usage_and_exit();
+    // Frames are only hashed in headless mode
+    if (frame_hashes_filename && !headless)
+        print_usage_and_exit();
 #endif
 
     install_fatal_signal_handlers();
 
     // One-time initialization of various components
     init_apu();
+    init_compose();
     init_input();
     init_mappers();
 
 #ifndef RUN_TESTS
-    load_rom(argv[1], true);
+    if (benchmark_rom) {
+        // Run without pacing, and print nothing but the results
+#  ifndef HEADLESS
+        headless = true;
+#  endif
+        run_benchmark(benchmark_rom, benchmark_frames);
+        return 0;
+    }
+#endif
+
+#if defined(HEADLESS) && !defined(RUN_TESTS)
+    if (argc - first_arg > 1) {
+        run_in_parallel(argv + first_arg, argc - first_arg);
+        puts("Shut down cleanly");
+        return 0;
+    }
+#endif
+
+#ifndef RUN_TESTS
+    load_rom(argv[first_arg], true);
+    // Loaded by run() once the console has been powered on
+    set_startup_state_file(load_state_filename);
+    if (record_input_filename)
+        start_input_recording(record_input_filename);
+    else if (play_input_filename)
+        start_input_playback(play_input_filename);
+    if (frame_hashes_filename)
+        start_frame_hashes(frame_hashes_filename, hash_interval);
+    if (metrics_filename)
+        start_metrics(metrics_filename, metrics_interval);
 #endif
 
-    // Create a separate emulation thread and use this thread as the rendering
-    // thread
+    if (headless) {
+        // No window or audio device. Run the emulation on this thread.
+        emulation_thread(0);
+#ifndef RUN_TESTS
+        end_frame_hashes();
+        // Tests print their own summary
+        report_headless_run();
+#endif
+    }
+#ifndef HEADLESS
+    else {
+        // Create a separate emulation thread and use this thread as the
+        // rendering thread
 
-    init_sdl();
-    SDL_Thread *emu_thread;
-    fail_if(!(emu_thread = SDL_CreateThread(emulation_thread, "emulation", 0)),
-            "failed to create emulation thread: %s", SDL_GetError());
-    sdl_thread();
-    SDL_WaitThread(emu_thread, 0);
-    deinit_sdl();
+        init_sdl();
+        SDL_Thread *emu_thread;
+        fail_if(!(emu_thread = SDL_CreateThread(emulation_thread, "emulation", 0)),
+                "failed to create emulation thread: %s", SDL_GetError());
+        sdl_thread();
+        SDL_WaitThread(emu_thread, 0);
+        deinit_sdl();
+        if (print_pacing_stats)
+            print_frame_pacing_stats();
+    }
+#endif
 
 #ifndef RUN_TESTS
+    end_metrics();
+    // A Shift+F5 save or autosave might still be writing to the same file
+    finish_state_file_writes();
+    if (save_state_filename && !save_state_to_file(save_state_filename))
+        exit(EXIT_FAILURE);
+    end_input_replay();
     unload_rom();
 #endif
 
     puts("Shut down cleanly");
+
+#ifdef RUN_TESTS
+    return tests_passed ? EXIT_SUCCESS : EXIT_FAILURE;
+#endif
 }
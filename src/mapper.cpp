@@ -6,7 +6,6 @@
 
 static uint8_t nop_read(uint16_t) { return cpu_data_bus; } // Return open bus by default
 static void    nop_write(uint8_t, uint16_t) {}
-static void    nop_ppu_tick_callback() {}
 
 // Implicitly NULL-initialized
 Mapper_fns mapper_fns_table[256];
@@ -35,16 +34,14 @@ void init_mappers() {
     #define MAPPER_NONE(n)                                           \
       MAPPER_COMMON(n)                                               \
       mapper_fns_table[n].read              = nop_read;              \
-      mapper_fns_table[n].write             = nop_write;             \
-      mapper_fns_table[n].ppu_tick_callback = nop_ppu_tick_callback;
+      mapper_fns_table[n].write             = nop_write;
 
     // Mapper that only reacts to writes
     #define MAPPER_W(n)                                              \
       MAPPER_COMMON(n)                                               \
       void mapper_##n##_write(uint8_t, uint16_t);                    \
       mapper_fns_table[n].read              = nop_read;              \
-      mapper_fns_table[n].write             = mapper_##n##_write;    \
-      mapper_fns_table[n].ppu_tick_callback = nop_ppu_tick_callback;
+      mapper_fns_table[n].write             = mapper_##n##_write;
 
     // Mapper that reacts to writes and PPU events
     #define MAPPER_WP(n)                                                      \
@@ -115,20 +112,77 @@ void init_mappers() {
 // PRG is split up into four 8 KB pages to handle memory mapping. This is the
 // finest granularity switched by any mapper. These pointers point to the
 // beginning of each page.
-static uint8_t *prg_pages[4];
-static bool prg_page_is_ram[4]; // MMC5 can map WRAM into the $8000+ range
+static EMU_STATE uint8_t *prg_pages[4];
+static EMU_STATE bool prg_page_is_ram[4]; // MMC5 can map WRAM into the $8000+ range
+
+// Updates the CPU memory map after PRG page 'n' has changed
+static void map_prg_page(unsigned n) {
+    map_cpu_mem(0x8000 + 0x2000*n, 0x2000, prg_pages[n],
+                prg_page_is_ram[n] ? wram_dirty_flags(prg_pages[n]) : 0);
+}
 
 uint8_t read_prg(uint16_t addr) {
     return prg_pages[(addr >> 13) & 3][addr & 0x1FFF];
 }
 
 void write_prg(uint16_t addr, uint8_t val) {
-    if (prg_page_is_ram[(addr >> 13) & 3])
-        prg_pages[(addr >> 13) & 3][addr & 0x1FFF] = val;
+    if (prg_page_is_ram[(addr >> 13) & 3]) {
+        uint8_t *const p = prg_pages[(addr >> 13) & 3] + (addr & 0x1FFF);
+        *p = val;
+        *wram_dirty_flags(p) = 1;
+    }
 }
 
 // CHR is split up into eight 1 KB pages
-uint8_t *chr_pages[8];
+EMU_STATE uint8_t *chr_pages[8];
+
+// Decoded copy of all of CHR, one uint64_t per tile row. Rows for CHR-RAM are
+// redecoded as they are written. Rows for CHR-ROM never change.
+static EMU_STATE uint64_t *decoded_chr;
+EMU_STATE uint64_t const *decoded_chr_pages[8];
+
+uint64_t decode_chr_row(uint8_t low, uint8_t high) {
+    uint64_t res = 0;
+    for (unsigned i = 0; i < 8; ++i)
+        res |= uint64_t((NTH_BIT(high, 7 - i) << 1) | NTH_BIT(low, 7 - i)) << 8*i;
+    return res;
+}
+
+// Index of the decoded row containing the CHR byte at 'offset'. The low and
+// high bytes of a row are eight bytes apart.
+static size_t decoded_chr_index(size_t offset) {
+    return ((offset >> 1) & ~7) | (offset & 7);
+}
+
+void redecode_chr_byte(uint8_t const *chr_byte) {
+    size_t const offset = (chr_byte - chr_base) & ~8;
+    decoded_chr[decoded_chr_index(offset)] =
+      decode_chr_row(chr_base[offset], chr_base[offset + 8]);
+}
+
+void decode_chr() {
+    for (size_t offset = 0; offset < 0x2000*chr_8k_banks; offset += 16)
+        for (unsigned row = 0; row < 8; ++row)
+            decoded_chr[decoded_chr_index(offset + row)] =
+              decode_chr_row(chr_base[offset + row], chr_base[offset + row + 8]);
+}
+
+void init_decoded_chr() {
+    // Eight bytes of CHR per decoded row
+    size_t const n_rows = 0x2000*chr_8k_banks/2;
+    fail_if(!(decoded_chr = new (std::nothrow) uint64_t[n_rows]),
+            "failed to allocate %zu bytes for decoded CHR", sizeof(uint64_t)*n_rows);
+    decode_chr();
+}
+
+void deinit_decoded_chr() {
+    free_array_set_null(decoded_chr);
+}
+
+static void set_chr_page(unsigned n, uint8_t *page) {
+    chr_pages[n]         = page;
+    decoded_chr_pages[n] = decoded_chr + decoded_chr_index(page - chr_base);
+}
 
 void set_prg_32k_bank(unsigned bank) {
     if (prg_16k_banks == 1) {
@@ -143,8 +197,10 @@ void set_prg_32k_bank(unsigned bank) {
             prg_pages[i] = bank_ptr + 0x2000*i;
     }
 
-    for (unsigned i = 0; i < 4; ++i)
+    for (unsigned i = 0; i < 4; ++i) {
         prg_page_is_ram[i] = false;
+        map_prg_page(i);
+    }
 }
 
 void set_prg_16k_bank(unsigned n, int bank, bool is_ram /* = false */) {
@@ -168,6 +224,7 @@ void set_prg_16k_bank(unsigned n, int bank, bool is_ram /* = false */) {
     for (unsigned i = 0; i < 2; ++i) {
         prg_pages[2*n + i] = bank_ptr + 0x2000*i;
         prg_page_is_ram[2*n + i] = is_ram;
+        map_prg_page(2*n + i);
     }
 }
 
@@ -190,44 +247,50 @@ void set_prg_8k_bank(unsigned n, int bank, bool is_ram /* = false */) {
 
     prg_pages[n] = base + 0x2000*(bank & mask);
     prg_page_is_ram[n] = is_ram;
+    map_prg_page(n);
 }
 
 void set_chr_8k_bank(unsigned bank) {
     uint8_t *const bank_ptr = chr_base + 0x2000*(bank & (chr_8k_banks - 1));
     for (unsigned i = 0; i < 8; ++i)
-        chr_pages[i] = bank_ptr + 0x400*i;
+        set_chr_page(i, bank_ptr + 0x400*i);
 }
 
 void set_chr_4k_bank(unsigned n, unsigned bank) {
     assert(n < 2);
     uint8_t *const bank_ptr = chr_base + 0x1000*(bank & (2*chr_8k_banks - 1));
     for (unsigned i = 0; i < 4; ++i)
-        chr_pages[4*n + i] = bank_ptr + 0x400*i;
+        set_chr_page(4*n + i, bank_ptr + 0x400*i);
 }
 
 void set_chr_2k_bank(unsigned n, unsigned bank) {
     assert(n < 4);
     uint8_t *const bank_ptr = chr_base + 0x800*(bank & (4*chr_8k_banks - 1));
     for (unsigned i = 0; i < 2; ++i)
-        chr_pages[2*n + i] = bank_ptr + 0x400*i;
+        set_chr_page(2*n + i, bank_ptr + 0x400*i);
 }
 
 void set_chr_1k_bank(unsigned n, unsigned bank) {
     assert(n < 8);
-    chr_pages[n] = chr_base + 0x400*(bank & (8*chr_8k_banks - 1));
+    set_chr_page(n, chr_base + 0x400*(bank & (8*chr_8k_banks - 1)));
 }
 
-uint8_t *wram_6000_page;
+EMU_STATE uint8_t *wram_6000_page;
 
 void set_wram_6000_bank(unsigned bank) {
     wram_6000_page = wram_base + 0x2000*(bank & (wram_8k_banks - 1));
+    map_cpu_mem(0x6000, 0x2000, wram_6000_page, wram_dirty_flags(wram_6000_page));
+}
+
+uint8_t *wram_dirty_flags(uint8_t const *p) {
+    return p ? wram_dirty + (p - wram_base)/dirty_page_size : 0;
 }
 
 //
 // Mirroring
 //
 
-Mirroring mirroring;
+EMU_STATE Mirroring mirroring;
 
 void set_mirroring(Mirroring m) {
     // In four-screen mode, the cart is assumed to be wired so that the mapper
@@ -4,9 +4,9 @@
 
 #include "mapper.h"
 
-static unsigned temp_reg;
-static unsigned nth_write;
-static unsigned regs[4];
+static EMU_STATE unsigned temp_reg;
+static EMU_STATE unsigned nth_write;
+static EMU_STATE unsigned regs[4];
 
 static void apply_state() {
     switch (regs[0] & 3) {
@@ -4,7 +4,7 @@
 
 #include "mapper.h"
 
-uint8_t prg_bank, chr_bank;
+EMU_STATE uint8_t prg_bank, chr_bank;
 
 static void apply_state() {
     set_prg_32k_bank(prg_bank);
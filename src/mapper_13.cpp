@@ -4,7 +4,7 @@
 
 #include "mapper.h"
 
-static uint8_t chr_bank;
+static EMU_STATE uint8_t chr_bank;
 
 static void apply_state() {
     set_chr_4k_bank(1, chr_bank);
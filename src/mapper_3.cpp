@@ -7,7 +7,7 @@
 
 // Actual reg is only 2 bits wide, but some homebrew ROMs (e.g.
 // lolicatgirls) assume more is possible
-static uint8_t chr_bank;
+static EMU_STATE uint8_t chr_bank;
 
 static void apply_state() {
     set_chr_8k_bank(chr_bank);
@@ -8,7 +8,7 @@
 #include "rom.h"
 
 // 1 KB of extra on-chip memory
-static uint8_t exram[1024];
+static EMU_STATE uint8_t exram[1024];
 
 // Mirroring:
 //  ---------------------------
@@ -32,45 +32,45 @@ static uint8_t exram[1024];
 //    Vert:  $44  (%01 00 01 00)
 //    1ScA:  $00  (%00 00 00 00)
 //    1ScB:  $55  (%01 01 01 01)
-static uint8_t mmc5_mirroring;
+static EMU_STATE uint8_t mmc5_mirroring;
 
 // $5104:  [.... ..XX]    ExRAM mode
 //     %00 = Extra Nametable mode    ("Ex0")
 //     %01 = Extended Attribute mode ("Ex1")
 //     %10 = CPU access mode         ("Ex2")
 //     %11 = CPU read-only mode      ("Ex3")
-static unsigned exram_mode;
+static EMU_STATE unsigned exram_mode;
 
-static unsigned prg_mode;
-static unsigned chr_mode;
+static EMU_STATE unsigned prg_mode;
+static EMU_STATE unsigned chr_mode;
 
-static unsigned prg_banks[4];
-static unsigned sprite_chr_banks[8];
-static unsigned bg_chr_banks[4];
+static EMU_STATE unsigned prg_banks[4];
+static EMU_STATE unsigned sprite_chr_banks[8];
+static EMU_STATE unsigned bg_chr_banks[4];
 
-static unsigned wram_6000_bank;
+static EMU_STATE unsigned wram_6000_bank;
 
-static unsigned high_chr_bits; // $5130, pre-shifted by 6
+static EMU_STATE unsigned high_chr_bits; // $5130, pre-shifted by 6
 
 // Built-in multiplier in $5205/$5206
-static unsigned multiplicand, multiplier;
+static EMU_STATE unsigned multiplicand, multiplier;
 
 // Scanline IRQ and frame logic
 
-static bool    irq_pending;
-static bool    irq_enabled;
-static uint8_t irq_scanline;
-static uint8_t scanline_cnt;
-static bool    in_frame;
+static EMU_STATE bool    irq_pending;
+static EMU_STATE bool    irq_enabled;
+static EMU_STATE uint8_t irq_scanline;
+static EMU_STATE uint8_t scanline_cnt;
+static EMU_STATE bool    in_frame;
 
 // 'true' if the background CHR mappings are currently active. Only an
 // optimization at the moment.
-static bool using_bg_chr;
+static EMU_STATE bool using_bg_chr;
 
 // Fill mode
 
-static uint8_t fill_tile;
-static uint8_t fill_attrib;
+static EMU_STATE uint8_t fill_tile;
+static EMU_STATE uint8_t fill_attrib;
 
 // Extended attribute mode
 
@@ -78,18 +78,18 @@ static uint8_t fill_attrib;
 // is able to supply the corresponding attribute byte for the subsequent
 // attribute fetch. Use this to keep track of the previously fetched
 // non-attribute value from exram so we can do the same.
-static uint8_t exram_val;
+static EMU_STATE uint8_t exram_val;
 
 // Vertical split mode
 
 // $5200
-static bool     split_enabled;
-static bool     split_on_right;
-static unsigned split_tile_nr;
+static EMU_STATE bool     split_enabled;
+static EMU_STATE bool     split_on_right;
+static EMU_STATE unsigned split_tile_nr;
 // $5201
-static unsigned split_y_scroll;
+static EMU_STATE unsigned split_y_scroll;
 // $5202
-static unsigned split_chr_page;
+static EMU_STATE unsigned split_chr_page;
 
 static void use_bg_chr() {
     using_bg_chr = true;
@@ -417,9 +417,15 @@ void mapper_5_write_nt(uint8_t val, uint16_t addr) {
     unsigned const bit_offset = (addr >> 9) & 6;
     switch ((mmc5_mirroring >> bit_offset) & 3) {
     // Internal nametable A
-    case 0: ciram[addr & 0x03FF] = val; break;
+    case 0:
+        ciram[addr & 0x03FF] = val;
+        ciram_dirty[(addr & 0x03FF)/dirty_page_size] = 1;
+        break;
     // Internal nametable B
-    case 1: ciram[0x0400 | (addr & 0x03FF)] = val; break;
+    case 1:
+        ciram[0x0400 | (addr & 0x03FF)] = val;
+        ciram_dirty[(0x0400 | (addr & 0x03FF))/dirty_page_size] = 1;
+        break;
     // Use ExRAM as nametable
     case 2: if (exram_mode <= 1) exram[addr & 0x03FF] = val; break;
     // Assume the fill tile and attribute can't be written through the PPU in
@@ -6,7 +6,7 @@
 
 // TODO: This mapper has variants that work differently
 
-static uint8_t prg_bank;
+static EMU_STATE uint8_t prg_bank;
 
 static void apply_state() {
     set_prg_16k_bank(0, prg_bank);
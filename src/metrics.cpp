@@ -0,0 +1,165 @@
+#include "common.h"
+
+#include "metrics.h"
+
+bool metrics_enabled;
+
+// Upper bounds of the histogram buckets, inclusive. A final bucket holds
+// everything larger than the last bound. The times are chosen around the
+// length of a frame (16.6 ms for NTSC, 20 ms for PAL).
+static unsigned const time_bounds[] =
+  { 250, 500, 1000, 2000, 4000, 8000, 12000, 16000, 17000, 20000, 33000,
+    50000, 100000 };
+static unsigned const fill_bounds[] =
+  { 10, 20, 30, 40, 50, 60, 70, 80, 90 };
+
+unsigned const max_buckets = ARRAY_LEN(time_bounds) + 1;
+
+struct Histogram_info {
+    char const *name;
+    unsigned const *bounds;
+    unsigned n_bounds;
+};
+
+static Histogram_info const histogram_infos[N_METRICS] = {
+    { "emulation_us", time_bounds, ARRAY_LEN(time_bounds) },
+    { "sleep_us",     time_bounds, ARRAY_LEN(time_bounds) },
+    { "present_us",   time_bounds, ARRAY_LEN(time_bounds) },
+    { "audio_fill_percent", fill_bounds, ARRAY_LEN(fill_bounds) }
+};
+
+// Counts, sum, and max for the current interval
+struct Histogram {
+    uint64_t counts[max_buckets];
+    uint64_t sum;
+    unsigned max;
+};
+
+static Histogram histograms[N_METRICS];
+
+static char const *const counter_names[N_COUNTERS] =
+  { "dropped_frames", "audio_underflows", "audio_overflows" };
+static uint64_t counters[N_COUNTERS];
+
+static FILE *metrics_file;
+static char const *metrics_filename;
+// Length of an interval in nanoseconds
+static int64_t metrics_interval;
+
+// Only used from the emulation thread
+static int64_t metrics_start, interval_start;
+static int64_t last_frame_end;
+// Time slept since the end of the last frame
+static int64_t frame_sleep_time;
+// Frames run in the current interval
+static unsigned long interval_frames;
+
+int64_t metrics_clock() {
+    timespec ts;
+    errno_fail_if(clock_gettime(CLOCK_MONOTONIC, &ts) == -1,
+                  "failed to get time from clock_gettime()");
+    return 1000000000ll*ts.tv_sec + ts.tv_nsec;
+}
+
+void start_metrics(char const *filename, unsigned interval) {
+    assert(interval > 0);
+
+    if (!strcmp(filename, "-"))
+        metrics_file = stdout;
+    else
+        errno_fail_if(!(metrics_file = fopen(filename, "w")),
+                      "failed to open '%s' for writing metrics", filename);
+    metrics_filename = filename;
+    metrics_interval = 1000000000ll*interval;
+    metrics_start = interval_start = last_frame_end = metrics_clock();
+    metrics_enabled = true;
+}
+
+void record_metric(Metric metric, unsigned value) {
+    if (!metrics_enabled)
+        return;
+
+    Histogram_info const &info = histogram_infos[metric];
+    Histogram &h = histograms[metric];
+    unsigned bucket = 0;
+    while (bucket < info.n_bounds && value > info.bounds[bucket])
+        ++bucket;
+    __atomic_fetch_add(&h.counts[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h.sum, value, __ATOMIC_RELAXED);
+    unsigned max = __atomic_load_n(&h.max, __ATOMIC_RELAXED);
+    while (value > max &&
+           !__atomic_compare_exchange_n(&h.max, &max, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void count_metric(Counter counter) {
+    if (metrics_enabled)
+        __atomic_fetch_add(&counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+void record_sleep_time(int64_t nanos) {
+    if (!metrics_enabled)
+        return;
+
+    record_metric(METRIC_SLEEP, nanos/1000);
+    frame_sleep_time += nanos;
+}
+
+// Writes a line with the metrics for the interval ending at 'now' and starts
+// a new interval
+static void write_metrics(int64_t now) {
+    fprintf(metrics_file, "{\"time\": %.3f, \"interval\": %.3f, \"frames\": %lu",
+            (now - metrics_start)/1e9, (now - interval_start)/1e9, interval_frames);
+    for (unsigned i = 0; i < N_COUNTERS; ++i)
+        fprintf(metrics_file, ", \"%s\": %llu", counter_names[i],
+                (unsigned long long)__atomic_exchange_n(&counters[i], 0, __ATOMIC_RELAXED));
+
+    for (unsigned i = 0; i < N_METRICS; ++i) {
+        Histogram_info const &info = histogram_infos[i];
+        Histogram &h = histograms[i];
+
+        fprintf(metrics_file, ", \"%s\": {\"bounds\": [", info.name);
+        for (unsigned j = 0; j < info.n_bounds; ++j)
+            fprintf(metrics_file, j == 0 ? "%u" : ", %u", info.bounds[j]);
+        fputs("], \"counts\": [", metrics_file);
+        for (unsigned j = 0; j <= info.n_bounds; ++j)
+            fprintf(metrics_file, j == 0 ? "%llu" : ", %llu",
+                    (unsigned long long)__atomic_exchange_n(&h.counts[j], 0, __ATOMIC_RELAXED));
+        fprintf(metrics_file, "], \"sum\": %llu, \"max\": %u}",
+                (unsigned long long)__atomic_exchange_n(&h.sum, 0, __ATOMIC_RELAXED),
+                __atomic_exchange_n(&h.max, 0, __ATOMIC_RELAXED));
+    }
+    fputs("}\n", metrics_file);
+    errno_fail_if(fflush(metrics_file) == EOF,
+                  "failed to write metrics to '%s'", metrics_filename);
+
+    interval_start = now;
+    interval_frames = 0;
+}
+
+void metrics_end_of_frame() {
+    if (!metrics_enabled)
+        return;
+
+    int64_t const now = metrics_clock();
+    record_metric(METRIC_EMULATION,
+                  max(now - last_frame_end - frame_sleep_time, (int64_t)0)/1000);
+    last_frame_end = now;
+    frame_sleep_time = 0;
+    ++interval_frames;
+
+    if (now - interval_start >= metrics_interval)
+        write_metrics(now);
+}
+
+void end_metrics() {
+    if (!metrics_enabled)
+        return;
+
+    write_metrics(metrics_clock());
+    metrics_enabled = false;
+    if (metrics_file != stdout)
+        errno_fail_if(fclose(metrics_file) == EOF,
+                      "failed to close '%s'", metrics_filename);
+    metrics_file = 0;
+}
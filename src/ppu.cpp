@@ -1,5 +1,6 @@
 #include "common.h"
 
+#include "compose.h"
 #include "cpu.h"
 #include "ppu.h"
 #include "mapper.h"
@@ -10,119 +11,122 @@
 #include "palette.inc"
 
 // Points to the current palette as determined by the color tint bits
-static uint32_t const     *pal_to_rgb;
+static EMU_STATE uint32_t const     *pal_to_rgb;
 
 // If true, treat the emulated code as the first code that runs (i.e., not the
 // situation on PowerPak), which means writes to certain registers will be
 // inhibited during the initial frame. This breaks some demos.
 bool const                starts_on_initial_frame = false;
 
-uint8_t                   *ciram;
+EMU_STATE uint8_t                   *ciram;
+EMU_STATE uint8_t                   ciram_dirty[0x1000/dirty_page_size];
 
-unsigned                  prerender_line;
+EMU_STATE unsigned                  prerender_line;
 
-static uint8_t            palettes[0x20];
-static uint8_t            oam[0x100];
-static uint8_t            sec_oam[0x20];
+static EMU_STATE uint8_t            palettes[0x20];
+static EMU_STATE uint8_t            oam[0x100];
+static EMU_STATE uint8_t            sec_oam[0x20];
 
 // VRAM address/scroll regs. 15 bits long.
-static unsigned           t, v;
-static uint8_t            fine_x;
+static EMU_STATE unsigned           t, v;
+static EMU_STATE uint8_t            fine_x;
 // v is not immediately updated from t on the second write to $2006. This
 // variable implements the delay.
-static unsigned           pending_v_update;
+static EMU_STATE unsigned           pending_v_update;
 
-static unsigned           v_inc;           // $2000:2
-static uint16_t           sprite_pat_addr; // $2000:3
-static uint16_t           bg_pat_addr;     // $2000:4
-static enum Sprite_size {
+static EMU_STATE unsigned           v_inc;           // $2000:2
+static EMU_STATE uint16_t           sprite_pat_addr; // $2000:3
+static EMU_STATE uint16_t           bg_pat_addr;     // $2000:4
+static EMU_STATE enum Sprite_size {
     EIGHT_BY_EIGHT,
     EIGHT_BY_SIXTEEN
 }                         sprite_size;   // $2000:5
-static bool               nmi_on_vblank; // $2000:7
+static EMU_STATE bool               nmi_on_vblank; // $2000:7
 
 // $2001:0 - 0x30 if grayscale mode enabled, otherwise 0x3F
-static uint8_t            grayscale_color_mask;
-static bool               show_bg_left_8;       // $2001:1
-static bool               show_sprites_left_8;  // $2001:2
-static bool               show_bg;              // $2001:3
-static bool               show_sprites;         // $2001:4
-static uint8_t            tint_bits;            // $2001:7-5
-
-bool                      rendering_enabled;
+static EMU_STATE uint8_t            grayscale_color_mask;
+static EMU_STATE bool               show_bg_left_8;       // $2001:1
+static EMU_STATE bool               show_sprites_left_8;  // $2001:2
+static EMU_STATE bool               show_bg;              // $2001:3
+static EMU_STATE bool               show_sprites;         // $2001:4
+static EMU_STATE uint8_t            tint_bits;            // $2001:7-5
+
+EMU_STATE bool                      rendering_enabled;
 // Optimizations - if bg/sprites are disabled, a value is set that causes
 // comparisons to always fail. If the leftmost 8 pixels should be clipped,
 // comparisons only fail for those pixels. Otherwise, comparisons never fail.
-static unsigned           bg_clip_comp;
-static unsigned           sprite_clip_comp;
+static EMU_STATE unsigned           bg_clip_comp;
+static EMU_STATE unsigned           sprite_clip_comp;
 
-static bool               sprite_overflow; // $2002:5
-static bool               sprite_zero_hit; // $2002:6
-static bool               in_vblank;       // $2002:7
+static EMU_STATE bool               sprite_overflow; // $2002:5
+static EMU_STATE bool               sprite_zero_hit; // $2002:6
+static EMU_STATE bool               in_vblank;       // $2002:7
 
-static uint8_t            oam_addr; // $2003
+static EMU_STATE uint8_t            oam_addr; // $2003
 // Pointer into the secondary OAM, 5 bits wide
 //  - Updated during sprite evaluation and loading
 //  - Cleared at dots 64.5, 256.5 and 340.5, if rendering
-static unsigned           sec_oam_addr;
-static uint8_t            oam_data; // $2004 (seen when reading from $2004)
+static EMU_STATE unsigned           sec_oam_addr;
+static EMU_STATE uint8_t            oam_data; // $2004 (seen when reading from $2004)
 
 // Sprite evaluation state
 
 // Goes high for three ticks when an in-range sprite is found during sprite
 // evaluation
-static unsigned           copy_sprite_signal;
-static bool               oam_addr_overflow, sec_oam_addr_overflow;
-static bool               overflow_detection;
+static EMU_STATE unsigned           copy_sprite_signal;
+static EMU_STATE bool               oam_addr_overflow, sec_oam_addr_overflow;
+static EMU_STATE bool               overflow_detection;
 
 // PPUSCROLL/PPUADDR write flip-flop. First write when false, second write when
 // true.
-static bool               write_flip_flop;
+static EMU_STATE bool               write_flip_flop;
 
-static uint8_t            ppu_data_reg; // $2007 read buffer
+static EMU_STATE uint8_t            ppu_data_reg; // $2007 read buffer
 
-static bool               odd_frame;
+static EMU_STATE bool               odd_frame;
 
-uint64_t                  ppu_cycle;
+EMU_STATE uint64_t                  ppu_cycle;
 
 // Internal PPU counters and registers
 
-unsigned                  dot, scanline;
+EMU_STATE unsigned                  dot, scanline;
 
-static uint8_t            nt_byte, at_byte;
-static uint8_t            bg_byte_l, bg_byte_h;
-static uint16_t           bg_shift_l, bg_shift_h;
-static unsigned           at_shift_l, at_shift_h;
-static unsigned           at_latch_l, at_latch_h;
+static EMU_STATE uint8_t            nt_byte, at_byte;
+static EMU_STATE uint8_t            bg_byte_l, bg_byte_h;
+static EMU_STATE uint16_t           bg_shift_l, bg_shift_h;
+static EMU_STATE unsigned           at_shift_l, at_shift_h;
+static EMU_STATE unsigned           at_latch_l, at_latch_h;
 
-static uint8_t            sprite_attribs[8];
-static uint8_t            sprite_x[8];
-static uint8_t            sprite_pat_l[8];
-static uint8_t            sprite_pat_h[8];
+static EMU_STATE uint8_t            sprite_attribs[8];
+static EMU_STATE uint8_t            sprite_x[8];
+static EMU_STATE uint8_t            sprite_pat_l[8];
+static EMU_STATE uint8_t            sprite_pat_h[8];
 
-static bool               s0_on_next_scanline;
-static bool               s0_on_cur_scanline;
+static EMU_STATE bool               s0_on_next_scanline;
+static EMU_STATE bool               s0_on_cur_scanline;
 
 // Temporary storage (also exists in PPU) for data during sprite loading
-static uint8_t            sprite_y, sprite_index;
-static bool               sprite_in_range;
+static EMU_STATE uint8_t            sprite_y, sprite_index;
+static EMU_STATE bool               sprite_in_range;
 
 // Writes to certain registers are suppressed during the initial frame:
 // http://wiki.nesdev.com/w/index.php/PPU_power_up_state
 //
 // Emulating this makes NY2011 and possibly other demos hang. They probably
 // don't run on the real thing either.
-static bool               initial_frame;
+static EMU_STATE bool               initial_frame;
 
-unsigned                  ppu_addr_bus;
+EMU_STATE unsigned                  ppu_addr_bus;
 
 // Open bus for reads from PPU $2000-$2007 (tested by ppu_open_bus.nes).
 // "wcycle" is short for "write cycle".
 
-static uint8_t            ppu_open_bus;
-static uint64_t           bit_7_6_wcycle, bit_5_wcycle, bit_4_0_wcycle;
+static EMU_STATE uint8_t            ppu_open_bus;
+static EMU_STATE uint64_t           bit_7_6_wcycle, bit_5_wcycle, bit_4_0_wcycle;
 
-static unsigned           open_bus_decay_cycles;
+static EMU_STATE unsigned           open_bus_decay_cycles;
+
+EMU_STATE bool                      ppu_no_video;
 
 void init_ppu_for_rom() {
     prerender_line = is_pal ? 311 : 261;
@@ -163,6 +167,11 @@ static uint8_t &chr_ref(unsigned chr_addr) {
     return chr_pages[(chr_addr >> 10) & 7][chr_addr & 0x03FF];
 }
 
+// Returns the decoded pattern row whose low byte is at 'chr_addr'
+static uint64_t decoded_chr_row(unsigned chr_addr) {
+    return decoded_chr_pages[(chr_addr >> 10) & 7][((chr_addr >> 1) & 0x1F8) | (chr_addr & 7)];
+}
+
 // Nametable reading and writing
 
 // Returns the physical CIRAM address after mirroring
@@ -186,8 +195,11 @@ static uint8_t read_nt(uint16_t addr) {
 static void write_nt(uint16_t addr, uint8_t val) {
     if (mapper_fns.write_nt)
         mapper_fns.write_nt(val, addr);
-    else
-        ciram[get_mirrored_addr(addr)] = val;
+    else {
+        unsigned const ciram_addr = get_mirrored_addr(addr);
+        ciram[ciram_addr] = val;
+        ciram_dirty[ciram_addr/dirty_page_size] = 1;
+    }
 }
 
 // Bumps the horizontal bits in v every eight pixels during rendering
@@ -277,11 +289,11 @@ static void do_bg_fetches() {
     }
 }
 
-// Looks for an in-range sprite pixel at the current location.
+// Looks for an in-range sprite pixel at 'pixel' on the current line.
 // Performance hotspot!
 // Possible optimization: Set flag if any sprites on the line
-static unsigned get_sprite_pixel(unsigned &spr_pal, bool &spr_behind_bg, bool &spr_is_s0) {
-    unsigned const pixel = dot - 2;
+static unsigned get_sprite_pixel(unsigned pixel, unsigned &spr_pal, bool &spr_behind_bg,
+                                 bool &spr_is_s0) {
     // Equivalent to 'if (!show_sprites || (!show_sprites_left_8 && pixel < 8))'
     if (pixel < sprite_clip_comp)
         return 0;
@@ -326,7 +338,7 @@ static void do_pixel_output_and_sprite_zero() {
 
 	unsigned const spr_pat = 
 		((pixel >= 0) && (pixel < 256)) ? 
-		get_sprite_pixel(spr_pal, spr_behind_bg, spr_is_s0) : 0;
+		get_sprite_pixel(pixel, spr_pal, spr_behind_bg, spr_is_s0) : 0;
 
         // Equivalent to 'if (!show_bg || (!show_bg_left_8 && pixel < 8))'
         if ((pixel < (int)bg_clip_comp) || (pixel >= 256))
@@ -355,6 +367,25 @@ static void do_pixel_output_and_sprite_zero() {
     put_pixel(pixel, scanline, pal_to_rgb[palettes[pal_index] & grayscale_color_mask]);
 }
 
+// Version of do_pixel_output_and_sprite_zero() for frames without pixel
+// output (see ppu_no_video). Only does sprite zero hit detection.
+static void do_sprite_zero() {
+    // The flag stays set until the pre-render line
+    if (!rendering_enabled || !s0_on_cur_scanline || sprite_zero_hit)
+        return;
+
+    const int pixel = (dot >= 328) ? dot - 343 : dot - 2;
+    // No hit at pixel 255
+    if (pixel < (int)bg_clip_comp || pixel >= 255)
+        return;
+
+    bool     spr_behind_bg, spr_is_s0;
+    unsigned spr_pal;
+    if (get_sprite_pixel(pixel, spr_pal, spr_behind_bg, spr_is_s0) && spr_is_s0 &&
+        ((NTH_BIT(bg_shift_h, 15 - fine_x) << 1) | NTH_BIT(bg_shift_l, 15 - fine_x)))
+        sprite_zero_hit = true;
+}
+
 // Shifts the background shift registers, reloading the upper eight bits and
 // the attribute bits every eight pixels
 static void do_shifts_and_reloads() {
@@ -640,34 +671,205 @@ static void do_render_line_ops() {
     }
 }
 
+// Secondary OAM clear and sprite evaluation for the next line, during dots
+// 1-256 of the visible lines
+static void do_sec_oam_ops() {
+    switch (dot) {
+    case 1 ... 64:
+        // Secondary OAM clear
+        if (dot & 1)
+            oam_data = 0xFF;
+        else {
+            sec_oam[sec_oam_addr] = oam_data;
+            // Should this be done when setting oam_data? Extremely
+            // obscure.
+            sec_oam_addr = (sec_oam_addr + 1) & 0x1F;
+        }
+        break;
+
+    case 65 ... 256:
+        do_sprite_evaluation();
+    }
+}
+
 // Called for dots on the visible lines (0-239)
 static void do_visible_line_ops() {
 
-    if ( (dot <= 268) || (dot >= 328) )
-        do_pixel_output_and_sprite_zero();
+    if ( (dot <= 268) || (dot >= 328) ) {
+        if (ppu_no_video)
+            do_sprite_zero();
+        else
+            do_pixel_output_and_sprite_zero();
+    }
 
     if (rendering_enabled) {
         do_render_line_ops();
+        do_sec_oam_ops();
+    }
+}
 
-        switch (dot) {
-        case 1 ... 64:
-            // Secondary OAM clear
-            if (dot & 1)
-                oam_data = 0xFF;
-            else {
-                sec_oam[sec_oam_addr] = oam_data;
-                // Should this be done when setting oam_data? Extremely
-                // obscure.
-                sec_oam_addr = (sec_oam_addr + 1) & 0x1F;
-            }
+// Pixel output for run_visible_line_dots_1_to_256(), from the decoded pattern
+// rows and attribute latch bits of the tiles that make up the line. The
+// background and sprite pixels for the line are put in planes and combined by
+// compose_pixels(). Pixel n comes from pixel n + fine_x of the tile sequence.
+// Pixel -1 (output at dot 1) always shows the backdrop, and pixel 255 (dot
+// 257) is left to the dot-by-dot path.
+static void do_batched_pixel_output(uint64_t const rows[34], unsigned const latch_l[34],
+                                    unsigned const latch_h[34]) {
+    uint8_t bg_plane[8*33];
+    // Tile 0 gets its attribute bits from at_shift_l/h, which could differ
+    // between pixels
+    for (unsigned bit = 0; bit < 8; ++bit) {
+        unsigned const pat       = (rows[0] >> 8*bit) & 3;
+        unsigned const attr_bits = (NTH_BIT(at_shift_h, 7 - bit) << 1) |
+                                    NTH_BIT(at_shift_l, 7 - bit);
+        bg_plane[bit] = pat ? (attr_bits << 2) | pat : 0;
+    }
+    for (unsigned tile = 1; tile < 33; ++tile) {
+        // 0xFF in each byte that holds an opaque pixel
+        uint64_t const opaque =
+          ((rows[tile] | (rows[tile] >> 1)) & UINT64_C(0x0101010101010101))*0xFF;
+        uint64_t const attr_bits = (latch_h[tile] << 1) | latch_l[tile];
+        uint64_t const pal_indices =
+          rows[tile] | (opaque & (UINT64_C(0x0404040404040404)*attr_bits));
+        memcpy(bg_plane + 8*tile, &pal_indices, sizeof pal_indices);
+    }
+    // Equivalent to '!show_bg || (!show_bg_left_8 && pixel < 8)' for the
+    // cleared pixels
+    memset(bg_plane + fine_x, 0, min(bg_clip_comp, 255u));
+
+    uint8_t spr_plane[256];
+    memset(spr_plane, 0, sizeof spr_plane);
+    // Lower-numbered sprites have priority, so draw them last
+    for (unsigned i = 8; i-- > 0;)
+        for (unsigned offset = 0; offset < 8 && sprite_x[i] + offset < 256; ++offset) {
+            unsigned const pixel = sprite_x[i] + offset;
+            unsigned const pat   = (NTH_BIT(sprite_pat_h[i], 7 - offset) << 1) |
+                                    NTH_BIT(sprite_pat_l[i], 7 - offset);
+            // Equivalent to '!show_sprites || (!show_sprites_left_8 && pixel < 8)'
+            if (!pat || pixel < sprite_clip_comp)
+                continue;
+            spr_plane[pixel] = (0x10 + ((sprite_attribs[i] & 3) << 2) + pat) |
+                               ((sprite_attribs[i] & 0x20) ? SPR_BEHIND_BG : 0) |
+                               ((s0_on_cur_scanline && i == 0) ? SPR_ZERO : 0);
+        }
+
+    uint32_t colors[0x20];
+    for (unsigned i = 0; i < 0x20; ++i)
+        colors[i] = pal_to_rgb[palettes[i] & grayscale_color_mask];
+
+    uint32_t line[256];
+    line[0] = colors[0];
+    if (compose_pixels(bg_plane + fine_x, spr_plane, colors, line + 1, 255))
+        sprite_zero_hit = true;
+    put_pixels(-1, scanline, line, 256);
+}
+
+// Version of do_batched_pixel_output() for frames without pixel output (see
+// ppu_no_video). Only does sprite zero hit detection, which needs sprite zero
+// (which always wins priority when opaque) to overlap an opaque background
+// pixel.
+static void do_batched_sprite_zero(uint64_t const rows[34]) {
+    if (!s0_on_cur_scanline || sprite_zero_hit)
+        return;
+
+    for (unsigned offset = 0; offset < 8; ++offset) {
+        unsigned const pixel = sprite_x[0] + offset;
+        // Pixel 255 is left to the dot-by-dot path
+        if (pixel >= 255)
             break;
+        if (pixel < sprite_clip_comp || pixel < bg_clip_comp ||
+            !(NTH_BIT(sprite_pat_h[0], 7 - offset) | NTH_BIT(sprite_pat_l[0], 7 - offset)))
+            continue;
 
-        case 65 ... 256:
-            do_sprite_evaluation();
+        unsigned const bg_pixel = pixel + fine_x;
+        if ((rows[bg_pixel/8] >> 8*(bg_pixel%8)) & 3) {
+            sprite_zero_hit = true;
+            return;
         }
     }
 }
 
+// Scanline-batched version of do_visible_line_ops() for dots 1-256 of a
+// visible line, with rendering enabled. Instead of clocking the fetches and
+// shift registers dot by dot, the 32 tiles fetched during those dots are read
+// up front and the pixels are produced straight from them. All PPU state ends
+// up the same as after running the dots one at a time.
+//
+// This is only valid if nothing outside the PPU can observe or modify PPU
+// state in the middle of the line. run_ppu() guarantees it by only using this
+// when the current catch-up batch covers all 256 dots. The CPU syncs the PPU
+// before each PPU register access (and before mapper writes and OAM DMA), so a
+// register write during the line splits the batch and the dot-by-dot path is
+// used instead.
+static void run_visible_line_dots_1_to_256() {
+    // Pattern bytes, decoded pattern rows (see decoded_chr_pages), and
+    // attribute latch bits for the tiles that make up the line, in the order
+    // they are shifted out. Tiles 0 and 1 were fetched at the end of the
+    // previous line and are in the shift registers. Tiles 2-33 are fetched at
+    // dots 1-256 (tile 33 isn't visible and only affects the state left
+    // behind).
+    uint8_t  tile_l[34], tile_h[34];
+    uint64_t rows[34];
+    unsigned latch_l[34], latch_h[34];
+
+    tile_l[0] = bg_shift_l >> 8; tile_l[1] = bg_shift_l & 0xFF;
+    tile_h[0] = bg_shift_h >> 8; tile_h[1] = bg_shift_h & 0xFF;
+    rows[0] = decode_chr_row(tile_l[0], tile_h[0]);
+    rows[1] = decode_chr_row(tile_l[1], tile_h[1]);
+    // Attribute bits for tile 0 are already in at_shift_l/h and are looked up
+    // per pixel below
+    latch_l[1] = at_latch_l;
+    latch_h[1] = at_latch_h;
+
+    for (unsigned tile = 2; tile < 34; ++tile) {
+        assert(v <= 0x7FFF);
+        nt_byte = read_nt(0x2000 | (v & 0x0FFF));
+        at_byte = read_nt(0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 7));
+        ppu_addr_bus = bg_pat_addr + 16*nt_byte + (v >> 12);
+        rows[tile]   = decoded_chr_row(ppu_addr_bus);
+        tile_l[tile] = bg_byte_l = chr_ref(ppu_addr_bus);
+        ppu_addr_bus += 8;
+        tile_h[tile] = bg_byte_h = chr_ref(ppu_addr_bus);
+        bump_horiz();
+
+        // Latched at the reload on the following dot. See
+        // do_shifts_and_reloads(). The latch for tile 33 happens at dot 257,
+        // after bump_vert(), and is left to the dot-by-dot path.
+        unsigned const at_bits = at_byte >> (((v >> 4) & 4) | ((v - 1) & 2));
+        latch_l[tile] = at_bits & 1;
+        latch_h[tile] = (at_bits >> 1) & 1;
+    }
+    bump_vert();
+
+    if (ppu_no_video)
+        do_batched_sprite_zero(rows);
+    else
+        do_batched_pixel_output(rows, latch_l, latch_h);
+
+    // Leave the shift registers as after the shifts at dots 2-256. Tile n is
+    // shifted in by the reload at dot 8*(n - 2) + 9, and its attribute bits
+    // go into at_shift_l/h during the eight shifts after that (only seven for
+    // tile 32, as the line stops at dot 256).
+    bg_shift_l = ((tile_l[31] << 8 | tile_l[32]) << 7) & 0xFFFF;
+    bg_shift_h = ((tile_h[31] << 8 | tile_h[32]) << 7) & 0xFFFF;
+    for (unsigned tile = 1; tile < 33; ++tile) {
+        unsigned const n = (tile == 32) ? 7 : 8;
+        at_shift_l = (at_shift_l << n) | (latch_l[tile] ? (1u << n) - 1 : 0);
+        at_shift_h = (at_shift_h << n) | (latch_h[tile] ? (1u << n) - 1 : 0);
+    }
+    at_latch_l = latch_l[32];
+    at_latch_h = latch_h[32];
+
+    // Sprite evaluation runs alongside the background and doesn't interact
+    // with it
+    for (dot = 1; dot <= 256; ++dot)
+        do_sec_oam_ops();
+    dot = 256;
+
+    ppu_cycle += 256;
+}
+
 // Called for dots on line 241
 static void do_line_241_ops() {
     if (dot == 1) {
@@ -746,15 +948,56 @@ static void tick_ppu() {
     }
 
     // Mapper-specific operations - usually to snoop on ppu_addr_bus
-    mapper_fns.ppu_tick_callback();
+    if (mapper_fns.ppu_tick_callback)
+        mapper_fns.ppu_tick_callback();
 }
 
-void tick_ntsc_ppu() {
-    tick_ppu<false, 261>();
+template<bool IS_PAL, unsigned PRERENDER_LINE>
+static void run_ppu(unsigned n_ticks) {
+    while (n_ticks > 0) {
+        // Batch dots 1-256 of visible lines if the whole range is covered.
+        // Mappers that snoop on the PPU need to see every fetch, and a pending
+        // delayed v update would land in the middle of the line.
+        if (dot == 0 && n_ticks >= 256 && scanline < 240 && rendering_enabled &&
+            pending_v_update == 0 && !mapper_fns.ppu_tick_callback) {
+
+            run_visible_line_dots_1_to_256();
+            n_ticks -= 256;
+        }
+        else {
+            tick_ppu<IS_PAL, PRERENDER_LINE>();
+            --n_ticks;
+        }
+    }
+}
+
+void run_ntsc_ppu(unsigned n_ticks) {
+    run_ppu<false, 261>(n_ticks);
+}
+
+void run_pal_ppu(unsigned n_ticks) {
+    run_ppu<true, 311>(n_ticks);
 }
 
-void tick_pal_ppu() {
-    tick_ppu<true, 311>();
+unsigned ppu_ticks_till_event() {
+    // Mappers that snoop on the PPU need to see it tick in lockstep with the
+    // CPU
+    if (mapper_fns.ppu_tick_callback)
+        return 0;
+
+    // Frame completion is signaled at dot 0 of line 240, and NMI is asserted
+    // at dot 1 of line 241
+    unsigned const frame_completion_pos = 341*240;
+    unsigned const nmi_pos              = 341*241 + 1;
+
+    unsigned const pos = 341*scanline + dot;
+    if (pos < frame_completion_pos)
+        return frame_completion_pos - pos;
+    if (pos < nmi_pos)
+        return nmi_pos - pos;
+    // Frame completion in the next frame. Subtract one for the dot that might
+    // be skipped on odd frames.
+    return 341*(prerender_line + 1) - pos + frame_completion_pos - 1;
 }
 
 static void do_2007_post_access_bump() {
@@ -820,7 +1063,13 @@ static void write_vram(uint8_t val) {
     switch (v & 0x3FFF) {
 
     // Pattern tables
-    case 0x0000 ... 0x1FFF: if (chr_is_ram) chr_ref(v) = val; break;
+    case 0x0000 ... 0x1FFF:
+        if (chr_is_ram) {
+            chr_ref(v) = val;
+            chr_dirty[(&chr_ref(v) - chr_base)/dirty_page_size] = 1;
+            redecode_chr_byte(&chr_ref(v));
+        }
+        break;
     // Nametables
     case 0x2000 ... 0x3EFF: write_nt(v, val); break;
     // Palettes
@@ -1122,6 +1371,9 @@ void set_ppu_cold_boot_state() {
     init_array(sprite_x      , (uint8_t)0);
     init_array(sprite_pat_l  , (uint8_t)0);
     init_array(sprite_pat_h  , (uint8_t)0);
+
+    // Left over from the end of an earlier run otherwise
+    ppu_no_video = false;
 }
 
 void reset_ppu() {
@@ -1146,8 +1398,12 @@ void reset_ppu() {
 
 template<bool calculating_size, bool is_save>
 void transfer_ppu_state(uint8_t *&buf) {
-    if (chr_is_ram) TRANSFER_P(chr_base, chr_8k_banks*0x2000);
-    TRANSFER_P(ciram, mirroring == FOUR_SCREEN ? 0x1000 : 0x800);
+    if (chr_is_ram) {
+        TRANSFER_TRACKED(chr_base, chr_dirty, chr_8k_banks*0x2000);
+        if (!calculating_size && !is_save)
+            decode_chr();
+    }
+    TRANSFER_TRACKED(ciram, ciram_dirty, mirroring == FOUR_SCREEN ? 0x1000 : 0x800);
     TRANSFER(palettes)
     TRANSFER(oam) TRANSFER(sec_oam)
     TRANSFER(t) TRANSFER(v) TRANSFER(fine_x)
@@ -0,0 +1,182 @@
+#include "common.h"
+
+#include "cpu.h"
+#include "headless.h"
+#include "mapper.h"
+#include "replay.h"
+#include "rom.h"
+
+EMU_STATE Replay_mode replay_mode;
+
+static EMU_STATE FILE *replay_file;
+static EMU_STATE char const *replay_filename;
+// Line number in the log being played back, for error messages
+static EMU_STATE unsigned long replay_line;
+// Number of frames recorded or played back
+static EMU_STATE unsigned long replay_frames;
+
+// Button order within a port field. Bit 7 of the get_button_states() format
+// comes first.
+static char const button_chars[] = "RLDUTSBA";
+
+// Length of the base64-encoded ROM checksum, including the terminating null
+size_t const checksum_len = 25;
+
+// Formats the ROM checksum in base64, as used in .fm2 files
+static void format_checksum(char *out) {
+    static char const digits[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    for (unsigned i = 0; i < 16; i += 3) {
+        unsigned const n = i + 3 <= 16 ? 3 : 16 - i;
+        uint32_t bits = rom_md5[i] << 16;
+        if (n > 1) bits |= rom_md5[i + 1] << 8;
+        if (n > 2) bits |= rom_md5[i + 2];
+        for (unsigned j = 0; j < 4; ++j)
+            *out++ = j <= n ? digits[(bits >> (18 - 6*j)) & 0x3F] : '=';
+    }
+    *out = '\0';
+}
+
+void start_input_recording(char const *filename) {
+    assert(replay_mode == REPLAY_NONE);
+
+    errno_fail_if(!(replay_file = fopen(filename, "w")),
+                  "failed to open '%s' for recording input", filename);
+    replay_filename = filename;
+    replay_frames = 0;
+
+    fputs("version 3\n"
+          "emuVersion 0\n"
+          "fourscore 0\n"
+          "port0 1\n"
+          "port1 1\n"
+          "port2 0\n", replay_file);
+    char checksum[checksum_len];
+    format_checksum(checksum);
+    fprintf(replay_file, "romChecksum base64:%s\n", checksum);
+
+    replay_mode = REPLAY_RECORD;
+}
+
+void start_input_playback(char const *filename) {
+    assert(replay_mode == REPLAY_NONE);
+
+    errno_fail_if(!(replay_file = fopen(filename, "r")),
+                  "failed to open input log '%s'", filename);
+    replay_filename = filename;
+    replay_line = replay_frames = 0;
+
+    replay_mode = REPLAY_PLAY;
+}
+
+void end_input_replay() {
+    if (replay_mode == REPLAY_NONE)
+        return;
+
+    if (replay_mode == REPLAY_RECORD) {
+        errno_fail_if(fflush(replay_file) == EOF || ferror(replay_file),
+                      "failed to write input log '%s'", replay_filename);
+        printf("Recorded %lu frames of input to '%s'\n", replay_frames, replay_filename);
+    }
+    errno_fail_if(fclose(replay_file) == EOF, "failed to close '%s'", replay_filename);
+    replay_file = 0;
+    replay_mode = REPLAY_NONE;
+}
+
+static void record_frame(uint8_t const buttons[2], bool reset) {
+    char line[] = "|0|........|........||\n";
+
+    line[1] = reset ? '1' : '0';
+    for (unsigned port = 0; port < 2; ++port)
+        for (unsigned i = 0; i < 8; ++i)
+            if (buttons[port] & (0x80 >> i))
+                line[3 + 9*port + i] = button_chars[i];
+
+    errno_fail_if(fputs(line, replay_file) == EOF,
+                  "failed to write input log '%s'", replay_filename);
+    ++replay_frames;
+}
+
+// Parses a port field ending in '|'. Empty fields (unused ports) are treated
+// as no buttons being pressed.
+static bool parse_port(char const *&p, uint8_t &buttons) {
+    buttons = 0;
+    if (*p == '|') {
+        ++p;
+        return true;
+    }
+
+    for (unsigned i = 0; i < 8; ++i, ++p) {
+        if (*p == '\0' || *p == '|' || *p == '\n')
+            return false;
+        if (*p != '.' && *p != ' ')
+            buttons |= 0x80 >> i;
+    }
+
+    return *p++ == '|';
+}
+
+static void check_checksum(char const *line) {
+    char checksum[checksum_len];
+    format_checksum(checksum);
+
+    char const *logged = line + strlen("romChecksum ");
+    if (!strncmp(logged, "base64:", strlen("base64:")))
+        logged += strlen("base64:");
+    if (strncmp(logged, checksum, checksum_len - 1))
+        printf("Warning: input log '%s' was recorded with a different ROM\n",
+               replay_filename);
+}
+
+// Reads the next frame line. Returns false at the end of the log.
+static bool read_frame(uint8_t buttons[2], bool &reset) {
+    char line[256];
+
+    for (;;) {
+        if (!fgets(line, sizeof line, replay_file)) {
+            errno_fail_if(ferror(replay_file), "failed to read input log '%s'",
+                          replay_filename);
+            return false;
+        }
+        ++replay_line;
+        fail_if(!strchr(line, '\n') && !feof(replay_file),
+                "line %lu in input log '%s' is too long", replay_line, replay_filename);
+
+        if (line[0] == '|')
+            break;
+
+        // Header line
+        if (!strncmp(line, "romChecksum ", strlen("romChecksum ")))
+            check_checksum(line);
+    }
+
+    char const *p = line + 1;
+    char *end;
+    unsigned long const commands = strtoul(p, &end, 10);
+    p = end;
+    fail_if(p == line + 1 || *p++ != '|' || !parse_port(p, buttons[0]) ||
+            !parse_port(p, buttons[1]),
+            "malformed frame on line %lu in input log '%s'", replay_line, replay_filename);
+
+    // Bit 0 is a soft reset. Power cycling (bit 1) isn't supported.
+    reset = commands & 1;
+    ++replay_frames;
+
+    return true;
+}
+
+void replay_frame(uint8_t buttons[2], bool &reset) {
+    if (replay_mode == REPLAY_RECORD) {
+        record_frame(buttons, reset);
+        return;
+    }
+
+    if (!read_frame(buttons, reset)) {
+        printf("Input log '%s' ended after %lu frames\n", replay_filename, replay_frames);
+        end_input_replay();
+        // Nothing more would happen in a headless run without a frame limit
+        if (headless && headless_frame_limit == 0)
+            end_emulation();
+    }
+}
@@ -12,29 +12,33 @@
 #include "save_states.h"
 #include "timing.h"
 
-uint8_t *prg_base;
-unsigned prg_16k_banks;
+EMU_STATE uint8_t *prg_base;
+EMU_STATE unsigned prg_16k_banks;
 
-uint8_t *chr_base;
-unsigned chr_8k_banks;
-bool chr_is_ram;
+EMU_STATE uint8_t *chr_base;
+EMU_STATE unsigned chr_8k_banks;
+EMU_STATE bool chr_is_ram;
+EMU_STATE uint8_t *chr_dirty;
 
-uint8_t *wram_base;
-unsigned wram_8k_banks;
+EMU_STATE uint8_t *wram_base;
+EMU_STATE unsigned wram_8k_banks;
+EMU_STATE uint8_t *wram_dirty;
 
-bool is_pal;
+EMU_STATE bool is_pal;
 
-bool has_battery;
-bool has_trainer;
+EMU_STATE bool has_battery;
+EMU_STATE bool has_trainer;
 
-bool is_vs_unisystem;
-bool is_playchoice_10;
+EMU_STATE bool is_vs_unisystem;
+EMU_STATE bool is_playchoice_10;
 
-bool has_bus_conflicts;
+EMU_STATE bool has_bus_conflicts;
 
-Mapper_fns mapper_fns;
+EMU_STATE Mapper_fns mapper_fns;
 
-static uint8_t *rom_buf;
+EMU_STATE uint8_t rom_md5[16];
+
+static EMU_STATE uint8_t *rom_buf;
 
 char const *const mirroring_to_str[N_MIRRORING_MODES] =
   { "horizontal",
@@ -141,6 +145,8 @@ void load_rom(char const *filename, bool print_info) {
         wram_8k_banks = (mapper == 5) ? 8 : 1;
         fail_if(!(wram_6000_page = wram_base = alloc_array_init<uint8_t>(0x2000*wram_8k_banks, 0xFF)),
                 "failed to allocate %u KB of WRAM", 8*wram_8k_banks);
+        fail_if(!(wram_dirty = alloc_array_init<uint8_t>(0x2000*wram_8k_banks/dirty_page_size, 1)),
+                "failed to allocate dirty page flags for WRAM");
     }
 
     if ((chr_is_ram = (chr_8k_banks == 0))) {
@@ -148,8 +154,11 @@ void load_rom(char const *filename, bool print_info) {
         chr_8k_banks = (mapper == 13) ? 2 : 1;
         fail_if(!(chr_base = alloc_array_init<uint8_t>(0x2000*chr_8k_banks, 0xFF)),
                 "failed to allocate %u KB of CHR RAM", 8*chr_8k_banks);
+        fail_if(!(chr_dirty = alloc_array_init<uint8_t>(0x2000*chr_8k_banks/dirty_page_size, 1)),
+                "failed to allocate dirty page flags for CHR RAM");
     }
     else chr_base = prg_base + 16*1024*prg_16k_banks;
+    init_decoded_chr();
 
     #undef PRINT_INFO
 
@@ -167,7 +176,7 @@ void load_rom(char const *filename, bool print_info) {
     init_apu_for_rom();
     init_audio_for_rom();
     init_ppu_for_rom();
-    init_save_states_for_rom();
+    init_save_states_for_rom(filename, print_info);
 #ifdef RECORD_MOVIE
     // Needs to know whether PAL or NTSC, so can't be done in main()
     init_movie();
@@ -182,7 +191,10 @@ void unload_rom() {
     free_array_set_null(ciram);
     if (chr_is_ram)
         free_array_set_null(chr_base);
+    free_array_set_null(chr_dirty);
+    deinit_decoded_chr();
     free_array_set_null(wram_base);
+    free_array_set_null(wram_dirty);
 
     deinit_audio_for_rom();
     deinit_save_states_for_rom();
@@ -213,12 +225,12 @@ static void set_pal() {
 }
 
 static void do_rom_specific_overrides() {
-    static MD5_CTX md5_ctx;
-    static unsigned char md5[16];
+    static EMU_STATE MD5_CTX md5_ctx;
+    uint8_t const *const md5 = rom_md5;
 
     MD5_Init(&md5_ctx);
     MD5_Update(&md5_ctx, (void*)prg_base, 16*1024*prg_16k_banks);
-    MD5_Final(md5, &md5_ctx);
+    MD5_Final(rom_md5, &md5_ctx);
 
 #if 0
     for (unsigned i = 0; i < 16; ++i)
@@ -4,6 +4,7 @@
 #include "audio.h"
 #include "controller.h"
 #include "cpu.h"
+#include "headless.h"
 #include "input.h"
 #include "ppu.h"
 #include "mapper.h"
@@ -11,55 +12,183 @@
 #include "save_states.h"
 #include "timing.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 // Buffer for a single plain old save state. Not related to rewinding.
-static uint8_t *state;
+static EMU_STATE uint8_t *state;
 // Total state size. Varies depending on the mapper.
-static size_t state_size;
+static EMU_STATE size_t state_size;
 // For the plain old save state
-static bool has_save;
+static EMU_STATE bool has_save;
+// State of the real frame while running ahead. Allocated on first use.
+static EMU_STATE uint8_t *run_ahead_state;
+// Dirty page flags of the tracked memory areas (see dirty_page_size) in
+// run_ahead_state, in transfer order. Allocated along with it.
+static EMU_STATE uint8_t *run_ahead_dirty;
+// Set while saving or loading run_ahead_state. save_tracked() and
+// load_tracked() save and restore the dirty page flags here, advancing it.
+static EMU_STATE uint8_t *dirty_flags_pos;
+
+// Buffer for building save state files, and its size
+static EMU_STATE uint8_t *state_file_buf;
+static EMU_STATE size_t state_file_size;
+// Buffer for compressing save state files written by save_state_to_file()
+static EMU_STATE uint8_t *compressed_file_buf;
+// Compressed sections are decoded into this buffer when loading files
+static EMU_STATE uint8_t *decode_buf;
+// The ROM filename with ".state" appended
+static EMU_STATE char *state_filename;
+// The ROM filename with ".autosave.state" appended
+static EMU_STATE char *autosave_filename;
+// Loaded by load_startup_state(), if set
+static EMU_STATE char const *startup_state_filename;
+
+// Memory budget for rewinding in bytes. 0 disables rewinding.
+static EMU_STATE size_t rewind_budget = default_rewind_budget_mb*1024*1024;
+
+// The budget is split between rewind_buf and rewind_frames by assuming that
+// encoded states take at least this many bytes on average. Both buffers are
+// allocated lazily and grow as needed up to their share of the budget. New
+// states overwrite the oldest states when either one is full.
+size_t const min_avg_encoded_len = 256;
+
+// States are stored as run-length-encoded XOR deltas against the state from
+// the previous frame. Consecutive states differ in few bytes, so the deltas
+// are mostly runs of zeros. Every keyframe_interval'th state is a keyframe,
+// encoded against all zeros instead. The decoded most recent state is kept in
+// top_state, and earlier states are recovered by applying deltas to it in
+// reverse (XOR is its own inverse). Only popping a keyframe needs a longer
+// walk: the state before it is rebuilt forwards from the previous keyframe.
+unsigned const keyframe_interval = 300;
+
+struct Rewind_frame {
+    // Location and length of the encoded state in rewind_buf
+    size_t   offset;
+    uint32_t len;
+    bool     is_keyframe;
+    // Length of the frame in CPU ticks, which is used to cleanly reverse
+    // audio. The length varies since we always process finished frames at
+    // instruction boundaries to simplify things, and since actual frames vary
+    // in length by +-1 PPU tick on NTSC.
+    unsigned frame_len;
+};
+
+static EMU_STATE uint8_t *rewind_buf;
+static EMU_STATE size_t rewind_buf_size;
+// Ring buffer of recorded frames. rewind_buf_i is the index of the most
+// recent one. The oldest recorded frame is always a keyframe.
+static EMU_STATE Rewind_frame *rewind_frames;
+static EMU_STATE unsigned rewind_buf_i;
+static EMU_STATE unsigned n_rewind_frames;
+static EMU_STATE unsigned n_recorded_frames;
+static EMU_STATE unsigned frames_since_keyframe;
+
+// Decoded most recent state, the state being pushed, and its encoding
+static EMU_STATE uint8_t *top_state;
+static EMU_STATE uint8_t *new_state;
+static EMU_STATE uint8_t *encoded_state;
+static EMU_STATE size_t max_encoded_len;
+
+// Snapshots only copy the pages of tracked memory areas that have been written
+// since the previous snapshot (see dirty_page_size). To make that work,
+// new_state is kept equal to top_state between pushes, so that it already
+// holds the unmodified pages. The skipped pages are recorded in skip_ranges
+// (as offsets into new_state), which lets the encoder skip them too.
 
-#ifdef INCLUDE_REWIND
+struct Byte_range {
+    size_t start;
+    size_t end;
+};
 
-// Number of seconds of rewind to support. The rewind buffer is a ring buffer
-// where a new state will overwrite the oldest state when the buffer is full.
-unsigned const rewind_seconds = 10;
+// True while push_state() saves the state into new_state
+static EMU_STATE bool taking_snapshot;
+// True if all pages should be copied, because the previous snapshot isn't
+// known to match the current state
+static EMU_STATE bool full_snapshot;
+// Sorted, with no adjacent or overlapping ranges
+static EMU_STATE Byte_range *skip_ranges;
+static EMU_STATE unsigned n_skip_ranges;
 
-static uint8_t *rewind_buf;
-// frame_len[n] is the length of frame n in CPU ticks, which is used to cleanly
-// reverse audio. The length varies since we always process finished frames at
-// instruction boundaries to simplify things, and since actual frames vary in
-// length by +-1 PPU tick on NTSC. It would also be possible to store the
-// length directly in the rewind buffer together with the frame's data.
-static unsigned *frame_len;
-static unsigned rewind_buf_i;
-static unsigned n_rewind_frames;
-static unsigned n_recorded_frames;
+EMU_STATE bool is_backwards_frame;
 
-bool is_backwards_frame;
+// The components of the system state, in the order they are stored in state
+// buffers. Also the sections of save state files.
+enum State_section {
+    SEC_APU = 0,
+    SEC_CPU,
+    SEC_PPU,
+    SEC_CONTROLLER,
+    SEC_INPUT,
+    SEC_MAPPER,
+    N_STATE_SECTIONS
+};
 
-#endif
+// Section tags used in save state files
+static char const section_tags[N_STATE_SECTIONS][4] =
+  { { 'A', 'P', 'U', ' ' },
+    { 'C', 'P', 'U', ' ' },
+    { 'P', 'P', 'U', ' ' },
+    { 'C', 'T', 'R', 'L' },
+    { 'I', 'N', 'P', 'T' },
+    { 'M', 'A', 'P', 'R' } };
+
+// Size of each section. Depends on the mapper.
+static EMU_STATE size_t section_sizes[N_STATE_SECTIONS];
 
 template<bool calculating_size, bool is_save>
-static size_t transfer_system_state(uint8_t *buf) {
-    uint8_t *tmp = buf;
+static void transfer_section(unsigned section, uint8_t *&buf) {
+    switch (section) {
+    case SEC_APU:        transfer_apu_state<calculating_size, is_save>(buf);        break;
+    case SEC_CPU:        transfer_cpu_state<calculating_size, is_save>(buf);        break;
+    case SEC_PPU:        transfer_ppu_state<calculating_size, is_save>(buf);        break;
+    case SEC_CONTROLLER: transfer_controller_state<calculating_size, is_save>(buf); break;
+    case SEC_INPUT:      transfer_input_state<calculating_size, is_save>(buf);      break;
 
-    transfer_apu_state<calculating_size, is_save>(buf);
-    transfer_cpu_state<calculating_size, is_save>(buf);
-    transfer_ppu_state<calculating_size, is_save>(buf);
-    transfer_controller_state<calculating_size, is_save>(buf);
-    transfer_input_state<calculating_size, is_save>(buf);
+    case SEC_MAPPER:
+        if (calculating_size)
+            mapper_fns.state_size(buf);
+        else {
+            if (is_save)
+                mapper_fns.save_state(buf);
+            else
+                mapper_fns.load_state(buf);
+        }
+        break;
 
-    if (calculating_size)
-        mapper_fns.state_size(buf);
-    else {
-        if (is_save)
-            mapper_fns.save_state(buf);
-        else
-            mapper_fns.load_state(buf);
+    default: UNREACHABLE
+    }
+}
+
+// Saves or loads the state of each component to/from the corresponding
+// pointer in 'sections'
+template<bool is_save>
+static void transfer_sections(uint8_t *const sections[N_STATE_SECTIONS]) {
+    // Run the PPU up to the current CPU cycle so that no PPU ticks are owed
+    sync_ppu();
+
+    for (unsigned i = 0; i < N_STATE_SECTIONS; ++i) {
+        uint8_t *buf = sections[i];
+        transfer_section<false, is_save>(i, buf);
+        assert(size_t(buf - sections[i]) == section_sizes[i]);
     }
 
-    // Return size of state in bytes
-    return buf - tmp;
+    // The PPU position changed. This recomputes the sync deadline.
+    if (!is_save)
+        sync_ppu();
+}
+
+// Saves or loads the state to/from a contiguous buffer of size state_size
+template<bool is_save>
+static void transfer_system_state(uint8_t *buf) {
+    uint8_t *sections[N_STATE_SECTIONS];
+    for (unsigned i = 0; i < N_STATE_SECTIONS; ++i) {
+        sections[i] = buf;
+        buf += section_sizes[i];
+    }
+    transfer_sections<is_save>(sections);
 }
 
 //
@@ -67,52 +196,1009 @@ static size_t transfer_system_state(uint8_t *buf) {
 //
 
 void save_state() {
-    transfer_system_state<false, true>(state);
+    transfer_system_state<true>(state);
     has_save = true;
 }
 
 void load_state() {
     if (has_save) {
         // Clear rewind
-#ifdef INCLUDE_REWIND
-	    n_recorded_frames = 0;
-#endif
+        n_recorded_frames = 0;
+
+        transfer_system_state<false>(state);
+    }
+}
+
+// Upper bound on the number of dirty page flags. Each tracked memory area can
+// end in a partial page.
+static size_t max_dirty_flags() {
+    return state_size/dirty_page_size + 16;
+}
+
+void save_run_ahead_state() {
+    if (!run_ahead_state) {
+        fail_if(!(run_ahead_state = new (std::nothrow) uint8_t[state_size]),
+          "failed to allocate %zu-byte buffer for run-ahead state", state_size);
+        fail_if(!(run_ahead_dirty = new (std::nothrow) uint8_t[max_dirty_flags()]),
+          "failed to allocate buffer for run-ahead dirty page flags");
+    }
+
+    dirty_flags_pos = run_ahead_dirty;
+    transfer_system_state<true>(run_ahead_state);
+    assert(dirty_flags_pos <= run_ahead_dirty + max_dirty_flags());
+    dirty_flags_pos = 0;
+}
+
+void load_run_ahead_state() {
+    // Unlike load_state(), the rewind buffer is kept. Restoring the dirty page
+    // flags from when the state was saved keeps them describing how memory
+    // differs from top_state, so the next snapshot can still skip the clean
+    // pages.
+    dirty_flags_pos = run_ahead_dirty;
+    transfer_system_state<false>(run_ahead_state);
+    dirty_flags_pos = 0;
+}
+
+//
+// Zero-run encoding
+//
+
+// Used for rewind states and to compress save state files. The encoding is a
+// sequence of (zero run length, literal run length, literals) tuples, with
+// lengths stored as base-128 varints. Literal runs end at two consecutive
+// zeros. The tuples cover the input exactly.
+
+static uint8_t *put_varint(uint8_t *p, size_t n) {
+    for (; n >= 0x80; n >>= 7)
+        *p++ = 0x80 | (n & 0x7F);
+    *p++ = n;
+    return p;
+}
+
+// Returns null if the varint runs past 'end' or is too long
+static uint8_t const *get_varint(uint8_t const *p, uint8_t const *end, size_t &n) {
+    n = 0;
+    for (unsigned shift = 0; p != end && shift < CHAR_BIT*sizeof n; shift += 7) {
+        n |= size_t(*p & 0x7F) << shift;
+        if (!(*p++ & 0x80))
+            return p;
+    }
+    return 0;
+}
+
+// Upper bound on the length of the encoding of 'len' bytes. The encoding can
+// only get slightly larger than the input (each tuple after the first covers
+// at least two zero bytes), so this is generous.
+static size_t max_zero_run_len(size_t len) {
+    return 2*len + 16;
+}
+
+// Encodes 'len' bytes of 'in' XOR 'base' into 'out' and returns the length of
+// the encoding. 'base' can be null, in which case 'in' is encoded as is.
+// 'in' and 'base' are assumed to be equal within the 'n_skips' ranges in
+// 'skips', which are not examined.
+static size_t zero_run_encode(uint8_t const *in, uint8_t const *base, size_t len,
+                              Byte_range const *skips, unsigned n_skips, uint8_t *out) {
+    uint8_t *const out_start = out;
+    unsigned skip_i = 0;
+
+    #define DELTA(i) uint8_t(in[i] ^ (base ? base[i] : 0))
+
+    for (size_t i = 0; i < len;) {
+        size_t const zeros_start = i;
+        for (;;) {
+            if (skip_i < n_skips && i == skips[skip_i].start) {
+                i = skips[skip_i++].end;
+                continue;
+            }
+            size_t const scan_end = skip_i < n_skips ? skips[skip_i].start : len;
+            while (i < scan_end && DELTA(i) == 0)
+                ++i;
+            if (i != scan_end || i == len)
+                break;
+        }
+        size_t const lits_start = i;
+        // Literal runs end at skipped ranges as well
+        size_t const lits_end = skip_i < n_skips ? skips[skip_i].start : len;
+        while (i < lits_end && (DELTA(i) != 0 || (i + 1 < lits_end && DELTA(i + 1) != 0)))
+            ++i;
+
+        out = put_varint(out, lits_start - zeros_start);
+        out = put_varint(out, i - lits_start);
+        for (size_t j = lits_start; j < i; ++j)
+            *out++ = DELTA(j);
+    }
+
+    #undef DELTA
+
+    return out - out_start;
+}
+
+// XORs the 'in_len'-byte encoding 'in' into the 'out_len' bytes at 'out'.
+// Returns false if the encoding is malformed or doesn't cover exactly
+// 'out_len' bytes, in which case 'out' might have been partially modified.
+static bool apply_zero_runs(uint8_t const *in, size_t in_len, uint8_t *out, size_t out_len) {
+    uint8_t const *const end = in + in_len;
+    while (in != end) {
+        size_t n_zeros, n_lits;
+        if (!(in = get_varint(in, end, n_zeros)) || !(in = get_varint(in, end, n_lits)))
+            return false;
+        if (n_zeros > out_len || n_lits > out_len - n_zeros || n_lits > size_t(end - in))
+            return false;
+
+        out += n_zeros;
+        for (size_t i = 0; i < n_lits; ++i)
+            *out++ ^= *in++;
+        out_len -= n_zeros + n_lits;
+    }
+    return out_len == 0;
+}
+
+//
+// Save state files
+//
+
+// A save state file consists of a header followed by one section per
+// component. Each section has a header with a tag identifying the component,
+// the length of the component's state, and how it is stored. Sections start at
+// multiples of 16 bytes, so that uncompressed data is suitably aligned when the
+// file is mapped into memory and can be loaded in place. Values are in host
+// byte order.
+//
+// Sections with unknown tags are skipped when loading, so new sections can be
+// added without breaking old files. state_file_version must be bumped if the
+// contents of an existing section change.
+
+char const state_file_magic[8] = { 'N', 'E', 'S', 'A', 'L', 'I', 'Z', 'R' };
+uint32_t const state_file_version = 2;
+
+struct State_file_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t n_sections;
+    // MD5 of the PRG ROM, from rom_md5
+    uint8_t  rom_md5[16];
+};
+
+enum Section_encoding {
+    SEC_RAW = 0,
+    // Zero-run-encoded, for sections where that makes them smaller
+    SEC_ZERO_RUNS
+};
+
+struct State_file_section {
+    char     tag[4];
+    // Length of the component's state
+    uint32_t len;
+    // A Section_encoding
+    uint32_t encoding;
+    // Length of the data that follows, excluding padding. Equals 'len' for
+    // SEC_RAW.
+    uint32_t stored_len;
+};
+
+static size_t align_16(size_t n) {
+    return (n + 15) & ~size_t(15);
+}
+
+// Prints a message about a failed save state file operation. Returns false
+// for convenience.
+static bool state_file_error(bool include_errno, char const *format, ...)
+  __attribute__((format(printf, 2, 3)));
+
+static bool state_file_error(bool include_errno, char const *format, ...) {
+    int const errno_val = errno;
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%s: ", program_name);
+    vfprintf(stderr, format, args);
+    if (include_errno)
+        fprintf(stderr, ": %s", strerror(errno_val));
+    putc('\n', stderr);
+    va_end(args);
+    return false;
+}
+
+// Saves the current state into 'buf' (of size state_file_size) as an
+// uncompressed save state file. This is all that needs to happen on the
+// emulation thread; compress_state_file() and writing the file can happen
+// elsewhere.
+static void build_state_file(uint8_t *buf) {
+    State_file_header header;
+    memcpy(header.magic, state_file_magic, sizeof header.magic);
+    header.version    = state_file_version;
+    header.n_sections = N_STATE_SECTIONS;
+    memcpy(header.rom_md5, rom_md5, sizeof header.rom_md5);
+    memcpy(buf, &header, sizeof header);
 
-        transfer_system_state<false, false>(state);
+    uint8_t *sections[N_STATE_SECTIONS];
+    uint8_t *p = buf + sizeof header;
+    for (unsigned i = 0; i < N_STATE_SECTIONS; ++i) {
+        State_file_section section;
+        memcpy(section.tag, section_tags[i], sizeof section.tag);
+        section.len        = section_sizes[i];
+        section.encoding   = SEC_RAW;
+        section.stored_len = section_sizes[i];
+        memcpy(p, &section, sizeof section);
+
+        sections[i] = p + sizeof section;
+        p += sizeof section + align_16(section_sizes[i]);
+    }
+    assert(size_t(p - buf) == state_file_size);
+
+    transfer_sections<true>(sections);
+}
+
+// Upper bound on the size of a compressed save state file that is 'len' bytes
+// uncompressed
+static size_t max_compressed_file_size(size_t len) {
+    return max_zero_run_len(len) + 16*N_STATE_SECTIONS;
+}
+
+// Compresses the 'len'-byte uncompressed save state file 'in' (from
+// build_state_file()) into 'out' and returns the compressed size. Sections
+// that don't get smaller are stored raw. Doesn't touch emulation state, so
+// it's safe to call from any thread.
+static size_t compress_state_file(uint8_t const *in, size_t len, uint8_t *out) {
+    uint8_t const *const end = in + len;
+    uint8_t *const out_start = out;
+
+    memcpy(out, in, sizeof(State_file_header));
+    in  += sizeof(State_file_header);
+    out += sizeof(State_file_header);
+
+    while (in != end) {
+        State_file_section section;
+        memcpy(&section, in, sizeof section);
+        in += sizeof section;
+
+        uint8_t *const data = out + sizeof section;
+        size_t encoded_len = zero_run_encode(in, 0, section.len, 0, 0, data);
+        if (encoded_len < section.len)
+            section.encoding = SEC_ZERO_RUNS;
+        else {
+            encoded_len = section.len;
+            memcpy(data, in, section.len);
+        }
+        section.stored_len = encoded_len;
+        memset(data + encoded_len, 0, align_16(encoded_len) - encoded_len);
+        memcpy(out, &section, sizeof section);
+
+        in  += align_16(section.len);
+        out += sizeof section + align_16(encoded_len);
+    }
+
+    return out - out_start;
+}
+
+// Syncs the directory containing 'filename', so that a rename() into it
+// survives a crash
+static bool sync_parent_dir(char const *filename) {
+    char const *const slash = strrchr(filename, '/');
+    size_t const dir_len = !slash ? 0 : slash == filename ? 1 : slash - filename;
+    char *dir;
+    fail_if(!(dir = new (std::nothrow) char[dir_len + sizeof "."]),
+      "failed to allocate directory name for '%s'", filename);
+    if (dir_len == 0)
+        strcpy(dir, ".");
+    else {
+        memcpy(dir, filename, dir_len);
+        dir[dir_len] = '\0';
+    }
+
+    bool res = false;
+    int const fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd == -1)
+        state_file_error(true, "failed to open directory '%s'", dir);
+    else {
+        if (fsync(fd) == -1)
+            state_file_error(true, "failed to sync directory '%s'", dir);
+        else
+            res = true;
+        close(fd);
+    }
+
+    delete [] dir;
+    return res;
+}
+
+// Writes 'len' bytes from 'buf' to a temporary file, syncs it, and renames it
+// to 'filename'. The directory is synced after the rename too, so a crash
+// leaves either the complete old file or the complete new one behind.
+static bool write_file_durably(char const *filename, uint8_t const *buf, size_t len) {
+    size_t const filename_len = strlen(filename);
+    char *tmp_filename;
+    fail_if(!(tmp_filename = new (std::nothrow) char[filename_len + sizeof ".tmp"]),
+      "failed to allocate temporary filename for '%s'", filename);
+    memcpy(tmp_filename, filename, filename_len);
+    memcpy(tmp_filename + filename_len, ".tmp", sizeof ".tmp");
+
+    bool res = false;
+    int const fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        state_file_error(true, "failed to create '%s'", tmp_filename);
+        goto free_filename;
+    }
+
+    while (len > 0) {
+        ssize_t const n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            state_file_error(true, "failed to write '%s'", tmp_filename);
+            goto close_file;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    if (fsync(fd) == -1) {
+        state_file_error(true, "failed to sync '%s'", tmp_filename);
+        goto close_file;
+    }
+
+    res = true;
+
+close_file:
+    if (close(fd) == -1 && res) {
+        state_file_error(true, "failed to close '%s'", tmp_filename);
+        res = false;
+    }
+
+    if (res && rename(tmp_filename, filename) == -1) {
+        state_file_error(true, "failed to rename '%s' to '%s'", tmp_filename, filename);
+        res = false;
     }
+
+    if (!res)
+        unlink(tmp_filename);
+    else
+        res = sync_parent_dir(filename);
+
+free_filename:
+    delete [] tmp_filename;
+    return res;
+}
+
+bool save_state_to_file(char const *filename) {
+    build_state_file(state_file_buf);
+
+    size_t const len = compress_state_file(state_file_buf, state_file_size, compressed_file_buf);
+    return write_file_durably(filename, compressed_file_buf, len);
+}
+
+// Validates the save state file mapped at 'file' and loads it. Nothing is
+// loaded if the file is invalid.
+static bool load_state_from_mapping(char const *filename, uint8_t const *file, size_t len) {
+    State_file_header header;
+    if (len < sizeof header)
+        return state_file_error(false, "'%s' is too short to be a save state file", filename);
+    memcpy(&header, file, sizeof header);
+
+    if (memcmp(header.magic, state_file_magic, sizeof header.magic))
+        return state_file_error(false, "'%s' is not a save state file", filename);
+    if (header.version != state_file_version)
+        return state_file_error(false, "'%s' has save state format version %" PRIu32
+                                       ", expected version %" PRIu32,
+                                filename, header.version, state_file_version);
+    if (memcmp(header.rom_md5, rom_md5, sizeof rom_md5))
+        return state_file_error(false, "'%s' is a save state for a different ROM", filename);
+
+    uint8_t *sections[N_STATE_SECTIONS] = {};
+    size_t offset = sizeof header;
+    for (uint32_t n = 0; n < header.n_sections; ++n) {
+        State_file_section section;
+        if (len - offset < sizeof section)
+            return state_file_error(false, "'%s' is truncated", filename);
+        memcpy(&section, file + offset, sizeof section);
+        offset += sizeof section;
+
+        if (len - offset < align_16(section.stored_len))
+            return state_file_error(false, "'%s' is truncated", filename);
+
+        for (unsigned i = 0; i < N_STATE_SECTIONS; ++i)
+            if (!memcmp(section.tag, section_tags[i], sizeof section.tag)) {
+                if (section.len != section_sizes[i])
+                    return state_file_error(false, "the %.4s section in '%s' is %" PRIu32
+                                                   " bytes, expected %zu bytes",
+                                            section.tag, filename, section.len, section_sizes[i]);
+
+                switch (section.encoding) {
+                case SEC_RAW:
+                    if (section.stored_len != section.len)
+                        return state_file_error(false, "the %.4s section in '%s' is corrupt",
+                                                section.tag, filename);
+                    // The loading functions never write through the pointer
+                    sections[i] = const_cast<uint8_t*>(file) + offset;
+                    break;
+
+                case SEC_ZERO_RUNS:
+                    // Decode into the corresponding part of decode_buf
+                    sections[i] = decode_buf;
+                    for (unsigned j = 0; j < i; ++j)
+                        sections[i] += section_sizes[j];
+                    memset(sections[i], 0, section.len);
+                    if (!apply_zero_runs(file + offset, section.stored_len, sections[i], section.len))
+                        return state_file_error(false, "the %.4s section in '%s' is corrupt",
+                                                section.tag, filename);
+                    break;
+
+                default:
+                    return state_file_error(false, "the %.4s section in '%s' has unknown encoding %" PRIu32,
+                                            section.tag, filename, section.encoding);
+                }
+            }
+
+        offset += align_16(section.stored_len);
+    }
+
+    for (unsigned i = 0; i < N_STATE_SECTIONS; ++i)
+        if (!sections[i])
+            return state_file_error(false, "'%s' lacks the %.4s section", filename, section_tags[i]);
+
+    // Clear rewind
+    n_recorded_frames = 0;
+
+    transfer_sections<false>(sections);
+
+    return true;
 }
 
-#ifdef INCLUDE_REWIND
+bool load_state_from_file(char const *filename) {
+    int const fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return state_file_error(true, "failed to open '%s'", filename);
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        state_file_error(true, "failed to get size of '%s'", filename);
+        close(fd);
+        return false;
+    }
+    size_t const len = st.st_size;
+    if (len < sizeof(State_file_header)) {
+        close(fd);
+        return state_file_error(false, "'%s' is too short to be a save state file", filename);
+    }
+
+    void *const file = mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after closing
+    close(fd);
+    if (file == MAP_FAILED)
+        return state_file_error(true, "failed to map '%s' into memory", filename);
+
+    bool const res = load_state_from_mapping(filename, (uint8_t const*)file, len);
+    munmap(file, len);
+    return res;
+}
+
+char const *default_state_filename() {
+    return state_filename;
+}
+
+void set_startup_state_file(char const *filename) {
+    startup_state_filename = filename;
+}
+
+void load_startup_state() {
+    if (startup_state_filename && !load_state_from_file(startup_state_filename))
+        exit(EXIT_FAILURE);
+}
+
+//
+// Background writing of save state files
+//
+
+// The emulation thread only copies the state into a free buffer from a small
+// pool and queues it. A writer thread compresses and writes it, and then puts
+// the buffer back in the pool. If all buffers are in use, the write is refused
+// rather than waited for, so that writing never stalls emulation. The queue
+// holds at most one job per buffer.
+
+unsigned const n_write_bufs = 2;
+
+struct Write_job {
+    uint8_t *buf;
+    // One of the filenames built by init_save_states_for_rom(), which outlive
+    // the writer thread
+    char const *filename;
+};
+
+// Shared between the emulation thread and the writer thread. Everything the
+// writer thread needs is in here, as EMU_STATE variables are thread-local in
+// HEADLESS=1 builds.
+struct State_writer {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    // Signaled when a job is queued, when a job finishes, and on shutdown
+    pthread_cond_t cond;
+
+    uint8_t *free_bufs[n_write_bufs];
+    unsigned n_free_bufs;
+
+    Write_job queue[n_write_bufs];
+    unsigned queue_start;
+    unsigned queue_len;
+
+    bool exiting;
+
+    // Size of the uncompressed files in the buffers
+    size_t file_size;
+    // Used only by the writer thread
+    uint8_t *compressed;
+};
+
+static EMU_STATE State_writer *writer;
+
+static void *writer_thread(void *arg) {
+    State_writer &w = *(State_writer*)arg;
+
+    pthread_mutex_lock(&w.lock);
+    for (;;) {
+        while (w.queue_len == 0 && !w.exiting)
+            pthread_cond_wait(&w.cond, &w.lock);
+        // Finish queued writes before exiting
+        if (w.queue_len == 0)
+            break;
+
+        Write_job const job = w.queue[w.queue_start];
+        w.queue_start = (w.queue_start + 1) % n_write_bufs;
+        --w.queue_len;
+        pthread_mutex_unlock(&w.lock);
+
+        size_t const len = compress_state_file(job.buf, w.file_size, w.compressed);
+        write_file_durably(job.filename, w.compressed, len);
+
+        pthread_mutex_lock(&w.lock);
+        w.free_bufs[w.n_free_bufs++] = job.buf;
+        pthread_cond_broadcast(&w.cond);
+    }
+    pthread_mutex_unlock(&w.lock);
+
+    return 0;
+}
+
+static void start_writer() {
+    fail_if(!(writer = new (std::nothrow) State_writer),
+            "failed to allocate save state writer");
+    State_writer &w = *writer;
+
+    for (unsigned i = 0; i < n_write_bufs; ++i)
+        fail_if(!(w.free_bufs[i] = alloc_array_init<uint8_t>(state_file_size, 0)),
+                "failed to allocate %zu-byte buffer for writing save states", state_file_size);
+    w.n_free_bufs = n_write_bufs;
+    w.queue_start = w.queue_len = 0;
+    w.exiting     = false;
+    w.file_size   = state_file_size;
+    fail_if(!(w.compressed = new (std::nothrow) uint8_t[max_compressed_file_size(state_file_size)]),
+            "failed to allocate buffer for compressing save states");
+
+    int err;
+    if ((err = pthread_mutex_init(&w.lock, 0)))
+        errno_fail(err, "failed to initialize save state writer mutex");
+    if ((err = pthread_cond_init(&w.cond, 0)))
+        errno_fail(err, "failed to initialize save state writer condition variable");
+    if ((err = pthread_create(&w.thread, 0, writer_thread, writer)))
+        errno_fail(err, "failed to create save state writer thread");
+}
+
+// Waits for queued writes to finish and stops the writer thread
+static void stop_writer() {
+    if (!writer)
+        return;
+    State_writer &w = *writer;
+
+    pthread_mutex_lock(&w.lock);
+    w.exiting = true;
+    pthread_cond_broadcast(&w.cond);
+    pthread_mutex_unlock(&w.lock);
+    pthread_join(w.thread, 0);
+
+    pthread_cond_destroy(&w.cond);
+    pthread_mutex_destroy(&w.lock);
+    assert(w.n_free_bufs == n_write_bufs);
+    for (unsigned i = 0; i < n_write_bufs; ++i)
+        free_array_set_null(w.free_bufs[i]);
+    free_array_set_null(w.compressed);
+    delete writer;
+    writer = 0;
+}
+
+bool queue_state_file_write(char const *filename) {
+    assert(filename == state_filename || filename == autosave_filename);
+    // Started by init_save_states_for_rom() or set_autosave_interval(), so
+    // that the first write doesn't stall a frame on it
+    assert(writer);
+    State_writer &w = *writer;
+
+    pthread_mutex_lock(&w.lock);
+    if (w.n_free_bufs == 0) {
+        pthread_mutex_unlock(&w.lock);
+        return false;
+    }
+    uint8_t *const buf = w.free_bufs[--w.n_free_bufs];
+    pthread_mutex_unlock(&w.lock);
+
+    // The buffer is ours until it is queued
+    build_state_file(buf);
+
+    Write_job job;
+    job.buf      = buf;
+    job.filename = filename;
+
+    pthread_mutex_lock(&w.lock);
+    w.queue[(w.queue_start + w.queue_len++) % n_write_bufs] = job;
+    pthread_cond_broadcast(&w.cond);
+    pthread_mutex_unlock(&w.lock);
+
+    return true;
+}
+
+void finish_state_file_writes() {
+    if (!writer)
+        return;
+    State_writer &w = *writer;
+
+    pthread_mutex_lock(&w.lock);
+    while (w.n_free_bufs < n_write_bufs)
+        pthread_cond_wait(&w.cond, &w.lock);
+    pthread_mutex_unlock(&w.lock);
+}
+
+//
+// Autosaving
+//
+
+// 0 disables autosaving
+static EMU_STATE unsigned autosave_seconds;
+static EMU_STATE unsigned frames_since_autosave;
+
+void set_autosave_interval(unsigned seconds) {
+    autosave_seconds = seconds;
+    frames_since_autosave = 0;
+    // Usually set before a ROM is loaded, in which case
+    // init_save_states_for_rom() starts the writer
+    if (seconds != 0 && state && !writer)
+        start_writer();
+}
+
+void handle_autosave() {
+    if (autosave_seconds == 0 || ++frames_since_autosave < autosave_seconds*ppu_fps)
+        return;
+
+    // If the writer is still busy with earlier states, try again next frame
+    if (queue_state_file_write(autosave_filename))
+        frames_since_autosave = 0;
+}
 
 //
 // Rewinding
 //
 
+// Encodes new_state XOR 'base' into encoded_state and returns the length of
+// the encoding. 'base' is null for keyframes.
+static size_t encode_state(uint8_t const *base) {
+    // Skipped pages are only known to be equal in new_state and top_state
+    size_t const len = base ?
+      zero_run_encode(new_state, base, state_size, skip_ranges, n_skip_ranges, encoded_state) :
+      zero_run_encode(new_state, 0, state_size, 0, 0, encoded_state);
+    assert(len <= max_encoded_len);
+    return len;
+}
+
+// XORs the state encoded at 'frame' into 'state'
+static void apply_encoded_state(Rewind_frame const &frame, uint8_t *state) {
+    fail_if(!apply_zero_runs(rewind_buf + frame.offset, frame.len, state, state_size),
+            "corrupt state in rewind buffer");
+}
+
+static unsigned prev_frame_i(unsigned i) {
+    return (i == 0) ? n_rewind_frames - 1 : i - 1;
+}
+
+static unsigned oldest_frame_i() {
+    return (rewind_buf_i + n_rewind_frames - (n_recorded_frames - 1)) % n_rewind_frames;
+}
+
+// Finds room for 'len' bytes in rewind_buf after the most recent frame
+// without overwriting the oldest one. Returns false if there is none.
+static bool find_room(size_t len, size_t &offset) {
+    if (n_recorded_frames == 0) {
+        offset = 0;
+        return len <= rewind_buf_size;
+    }
+
+    Rewind_frame const &newest = rewind_frames[rewind_buf_i];
+    size_t const head = newest.offset + newest.len;
+    size_t const tail = rewind_frames[oldest_frame_i()].offset;
+
+    if (head > tail) {
+        // Used space doesn't wrap. Put the frame at the end, or wrap around.
+        if (rewind_buf_size - head >= len) {
+            offset = head;
+            return true;
+        }
+        offset = 0;
+        return len <= tail;
+    }
+    // Used space wraps around
+    offset = head;
+    return tail - head >= len;
+}
+
+// Drops the oldest keyframe and the deltas that depend on it
+static void drop_oldest_keyframe() {
+    assert(n_recorded_frames > 0);
+    do
+        --n_recorded_frames;
+    while (n_recorded_frames > 0 && !rewind_frames[oldest_frame_i()].is_keyframe);
+}
+
+// Shares of the budget for rewind_buf and rewind_frames
+static unsigned max_rewind_frames() {
+    return rewind_budget/(sizeof(Rewind_frame) + min_avg_encoded_len);
+}
+
+static size_t max_rewind_buf_size() {
+    return rewind_budget - sizeof(Rewind_frame)*max_rewind_frames();
+}
+
+static size_t encoded_bytes_used() {
+    size_t res = 0;
+    for (unsigned n = 0, i = rewind_buf_i; n < n_recorded_frames; ++n, i = prev_frame_i(i))
+        res += rewind_frames[i].len;
+    return res;
+}
+
+// Reallocates rewind_buf and rewind_frames with the given sizes, moving the
+// recorded frames to the beginning of each. The recorded frames must fit.
+// Returns false if allocation fails, leaving things as they were.
+static bool resize_rewind_buffers(size_t buf_size, unsigned n_frames) {
+    assert(n_recorded_frames <= n_frames);
+
+    uint8_t *const new_buf = new (std::nothrow) uint8_t[buf_size];
+    Rewind_frame *const new_frames = new (std::nothrow) Rewind_frame[n_frames];
+    if (!new_buf || !new_frames) {
+        delete [] new_buf;
+        delete [] new_frames;
+        return false;
+    }
+
+    size_t offset = 0;
+    for (unsigned n = 0, i = n_recorded_frames ? oldest_frame_i() : 0;
+         n < n_recorded_frames;
+         ++n, i = (i + 1) % n_rewind_frames) {
+
+        assert(offset + rewind_frames[i].len <= buf_size);
+        memcpy(new_buf + offset, rewind_buf + rewind_frames[i].offset, rewind_frames[i].len);
+        new_frames[n] = rewind_frames[i];
+        new_frames[n].offset = offset;
+        offset += rewind_frames[i].len;
+    }
+
+    free_array_set_null(rewind_buf);
+    free_array_set_null(rewind_frames);
+    rewind_buf      = new_buf;
+    rewind_buf_size = buf_size;
+    rewind_frames   = new_frames;
+    n_rewind_frames = n_frames;
+    rewind_buf_i    = n_recorded_frames ? n_recorded_frames - 1 : 0;
+
+    return true;
+}
+
+// Doubles rewind_frames, within the budget. Returns false if it can't grow.
+static bool grow_rewind_frames() {
+    unsigned const n_frames = min(max(2*n_rewind_frames, 1024u), max_rewind_frames());
+    return n_frames > n_rewind_frames && resize_rewind_buffers(rewind_buf_size, n_frames);
+}
+
+// Doubles rewind_buf, within the budget. Returns false if it can't grow.
+static bool grow_rewind_buf() {
+    size_t const buf_size = min(max(2*rewind_buf_size, size_t(1024*1024)), max_rewind_buf_size());
+    return buf_size > rewind_buf_size && resize_rewind_buffers(buf_size, n_rewind_frames);
+}
+
+static void free_rewind_buffers() {
+    free_array_set_null(rewind_buf);
+    free_array_set_null(rewind_frames);
+    free_array_set_null(top_state);
+    free_array_set_null(new_state);
+    free_array_set_null(encoded_state);
+    free_array_set_null(skip_ranges);
+    rewind_buf_size = n_rewind_frames = n_recorded_frames = rewind_buf_i = 0;
+}
+
+void set_rewind_budget_mb(unsigned mb) {
+    rewind_budget = size_t(mb)*1024*1024;
+
+    if (rewind_budget == 0) {
+        is_backwards_frame = false;
+        free_rewind_buffers();
+        return;
+    }
+
+    // Drop the oldest frames until the rest fit in the new budget, and shrink
+    // the buffers if they exceed it. Growing happens as frames are pushed.
+    if (rewind_buf_size > max_rewind_buf_size() || n_rewind_frames > max_rewind_frames()) {
+        while (n_recorded_frames > max_rewind_frames() ||
+               encoded_bytes_used() > max_rewind_buf_size())
+            drop_oldest_keyframe();
+        if (n_recorded_frames == 0)
+            is_backwards_frame = false;
+
+        resize_rewind_buffers(min(rewind_buf_size, max_rewind_buf_size()),
+                              min(n_rewind_frames, max_rewind_frames()));
+    }
+}
+
+unsigned rewind_budget_mb() {
+    return rewind_budget/(1024*1024);
+}
+
 unsigned get_frame_len() {
     assert(is_backwards_frame);
-    return frame_len[rewind_buf_i];
+    return rewind_frames[rewind_buf_i].frame_len;
+}
+
+void save_tracked(uint8_t const *mem, uint8_t *dirty, size_t len, uint8_t *buf) {
+    if (!taking_snapshot) {
+        memcpy(buf, mem, len);
+        if (dirty_flags_pos) {
+            size_t const n_flags = (len + dirty_page_size - 1)/dirty_page_size;
+            memcpy(dirty_flags_pos, dirty, n_flags);
+            dirty_flags_pos += n_flags;
+        }
+        return;
+    }
+
+    for (size_t offset = 0; offset < len; offset += dirty_page_size) {
+        size_t const page_len = min(dirty_page_size, len - offset);
+        uint8_t &page_dirty = dirty[offset/dirty_page_size];
+
+        if (page_dirty || full_snapshot) {
+            memcpy(buf + offset, mem + offset, page_len);
+            page_dirty = 0;
+        }
+        else {
+            // new_state already has the page. Record it as skipped, merging
+            // with the previous range if adjacent.
+            size_t const start = buf + offset - new_state;
+            if (n_skip_ranges > 0 && skip_ranges[n_skip_ranges - 1].end == start)
+                skip_ranges[n_skip_ranges - 1].end += page_len;
+            else {
+                skip_ranges[n_skip_ranges].start = start;
+                skip_ranges[n_skip_ranges].end   = start + page_len;
+                ++n_skip_ranges;
+            }
+        }
+    }
+}
+
+void load_tracked(uint8_t *mem, uint8_t *dirty, size_t len, uint8_t const *buf) {
+    memcpy(mem, buf, len);
+
+    size_t const n_flags = (len + dirty_page_size - 1)/dirty_page_size;
+    if (dirty_flags_pos) {
+        // Run-ahead state. See load_run_ahead_state().
+        memcpy(dirty, dirty_flags_pos, n_flags);
+        dirty_flags_pos += n_flags;
+    }
+    else
+        // For states loaded from the rewind buffer, the memory now matches
+        // top_state. Other loads clear the rewind buffer, and the next
+        // snapshot copies everything.
+        memset(dirty, 0, n_flags);
+}
+
+// Copies the parts of new_state that weren't skipped to top_state, making the
+// two equal again
+static void update_top_state() {
+    size_t start = 0;
+    for (unsigned i = 0; i <= n_skip_ranges; ++i) {
+        size_t const end = (i < n_skip_ranges) ? skip_ranges[i].start : state_size;
+        memcpy(top_state + start, new_state + start, end - start);
+        if (i < n_skip_ranges)
+            start = skip_ranges[i].end;
+    }
 }
 
 // Saves the current state to the rewind buffer. New states overwrite old if
 // the buffer becomes full.
 static void push_state() {
-    if (n_recorded_frames < n_rewind_frames)
-        ++n_recorded_frames;
+    if (!top_state) {
+        max_encoded_len = max_zero_run_len(state_size);
+        // There can be at most one skipped range per page, plus some slack for
+        // areas whose size isn't a multiple of dirty_page_size
+        size_t const max_skip_ranges = state_size/dirty_page_size + 16;
+        fail_if(!(top_state = new (std::nothrow) uint8_t[state_size]) ||
+                !(new_state = new (std::nothrow) uint8_t[state_size]) ||
+                !(encoded_state = new (std::nothrow) uint8_t[max_encoded_len]) ||
+                !(skip_ranges = new (std::nothrow) Byte_range[max_skip_ranges]),
+          "failed to allocate buffers for rewind states");
+    }
+
+    // Without recorded frames, top_state might not match anything
+    full_snapshot = n_recorded_frames == 0;
+    n_skip_ranges = 0;
+    taking_snapshot = true;
+    transfer_system_state<true>(new_state);
+    taking_snapshot = false;
+
+    bool is_keyframe = n_recorded_frames == 0 || frames_since_keyframe + 1 >= keyframe_interval;
+    size_t len = encode_state(is_keyframe ? 0 : top_state);
+    size_t offset;
+    for (;;) {
+        if (n_recorded_frames == n_rewind_frames) {
+            if (grow_rewind_frames())
+                continue;
+        }
+        else if (find_room(len, offset) || grow_rewind_buf())
+            // Check again after growing, as the frames have moved
+            if (find_room(len, offset))
+                break;
+
+        if (n_recorded_frames == 0)
+            // Doesn't fit even in an empty buffer. Can only happen with a
+            // tiny budget.
+            return;
+
+        drop_oldest_keyframe();
+        if (n_recorded_frames == 0 && !is_keyframe) {
+            // Dropped the keyframe the delta depended on
+            is_keyframe = true;
+            len = encode_state(0);
+        }
+    }
 
     rewind_buf_i = (rewind_buf_i + 1) % n_rewind_frames;
-    transfer_system_state<false, true>(rewind_buf + state_size*rewind_buf_i);
+    ++n_recorded_frames;
+    frames_since_keyframe = is_keyframe ? 0 : frames_since_keyframe + 1;
+
+    Rewind_frame &frame = rewind_frames[rewind_buf_i];
+    frame.offset      = offset;
+    frame.len         = len;
+    frame.is_keyframe = is_keyframe;
+    memcpy(rewind_buf + offset, encoded_state, len);
+
+    update_top_state();
 }
 
 // Removes the most recently pushed state from the rewind buffer
 static void pop_state() {
-    assert(n_recorded_frames > 0);
-    rewind_buf_i = (rewind_buf_i == 0) ? n_rewind_frames - 1 : rewind_buf_i - 1;
+    assert(n_recorded_frames > 1);
+
+    bool const popped_keyframe = rewind_frames[rewind_buf_i].is_keyframe;
+    if (!popped_keyframe)
+        // Undo the delta
+        apply_encoded_state(rewind_frames[rewind_buf_i], top_state);
+
+    rewind_buf_i = prev_frame_i(rewind_buf_i);
     --n_recorded_frames;
+
+    // Count the deltas back to the previous keyframe. Needed both to rebuild
+    // the state and to know when the next keyframe is due.
+    unsigned key_i = rewind_buf_i;
+    for (frames_since_keyframe = 0; !rewind_frames[key_i].is_keyframe; ++frames_since_keyframe)
+        key_i = prev_frame_i(key_i);
+
+    if (popped_keyframe) {
+        // Rebuild the state forwards from the previous keyframe
+        memset(top_state, 0, state_size);
+        for (unsigned i = key_i;; i = (i + 1) % n_rewind_frames) {
+            apply_encoded_state(rewind_frames[i], top_state);
+            if (i == rewind_buf_i)
+                break;
+        }
+    }
+
+    // Keep new_state equal to top_state (see skip_ranges)
+    memcpy(new_state, top_state, state_size);
 }
 
 // Loads the most recently pushed state from the rewind buffer
 static void load_top_state() {
-    transfer_system_state<false, false>(rewind_buf + state_size*rewind_buf_i);
+    transfer_system_state<false>(top_state);
 }
 
 static void handle_forwards_frame() {
@@ -141,9 +1227,13 @@ static void handle_backwards_frame() {
 }
 
 void handle_rewind(bool do_rewind) {
+    if (rewind_budget == 0)
+        return;
+
     // Save the length of the most recently finished frame in CPU ticks. Used
     // later to properly reverse audio if the frame is rewound.
-    frame_len[rewind_buf_i] = frame_offset;
+    if (n_recorded_frames > 0)
+        rewind_frames[rewind_buf_i].frame_len = frame_offset;
 
     if (do_rewind && n_recorded_frames > 0)
         handle_backwards_frame();
@@ -151,40 +1241,56 @@ void handle_rewind(bool do_rewind) {
         handle_forwards_frame();
 }
 
-#endif
-
-void init_save_states_for_rom() {
-#ifdef INCLUDE_REWIND
-    n_rewind_frames = rewind_seconds*ppu_fps;
-#endif
-
-    state_size = transfer_system_state<true, false>(0);
-#ifdef INCLUDE_REWIND
-    size_t const rewind_buf_size = state_size*n_rewind_frames;
-#endif
-#ifndef RUN_TESTS
-    printf("save state size: %zu bytes\n",
-           state_size);
-#endif
+void init_save_states_for_rom(char const *rom_filename, bool print_info) {
+    state_size = 0;
+    state_file_size = sizeof(State_file_header);
+    for (unsigned i = 0; i < N_STATE_SECTIONS; ++i) {
+        uint8_t *buf = 0;
+        transfer_section<true, false>(i, buf);
+        section_sizes[i] = buf - (uint8_t*)0;
+        state_size += section_sizes[i];
+        state_file_size += sizeof(State_file_section) + align_16(section_sizes[i]);
+    }
+    if (print_info)
+        printf("save state size: %zu bytes\n",
+               state_size);
     fail_if(!(state = new (std::nothrow) uint8_t[state_size]),
       "failed to allocate %zu-byte buffer for save state", state_size);
-#ifdef INCLUDE_REWIND
-    fail_if(!(rewind_buf = new (std::nothrow) uint8_t[rewind_buf_size]),
-      "failed to allocate %zu-byte rewind buffer", rewind_buf_size);
-    fail_if(!(frame_len = new (std::nothrow) unsigned[n_rewind_frames]),
-      "failed to allocate %zu-byte buffer for frame lengths",
-      sizeof(unsigned)*n_rewind_frames);
+    // Zero-initialized so that the padding is zeroed
+    fail_if(!(state_file_buf = alloc_array_init<uint8_t>(state_file_size, 0)),
+      "failed to allocate %zu-byte buffer for save state files", state_file_size);
+    fail_if(!(compressed_file_buf = new (std::nothrow) uint8_t[max_compressed_file_size(state_file_size)]),
+      "failed to allocate buffer for compressing save state files");
+    fail_if(!(decode_buf = new (std::nothrow) uint8_t[state_size]),
+      "failed to allocate %zu-byte buffer for loading save state files", state_size);
+    // The rewind buffers are allocated when the first state is pushed
 
-    rewind_buf_i = 0;
-#endif
+    size_t const rom_filename_len = strlen(rom_filename);
+    fail_if(!(state_filename = new (std::nothrow) char[rom_filename_len + sizeof ".state"]) ||
+            !(autosave_filename = new (std::nothrow) char[rom_filename_len + sizeof ".autosave.state"]),
+      "failed to allocate save state filenames");
+    memcpy(state_filename, rom_filename, rom_filename_len);
+    memcpy(state_filename + rom_filename_len, ".state", sizeof ".state");
+    memcpy(autosave_filename, rom_filename, rom_filename_len);
+    memcpy(autosave_filename + rom_filename_len, ".autosave.state", sizeof ".autosave.state");
+
+    // Start the writer up front if anything might queue writes: Shift+F5
+    // with a window, or autosaving
+    if (!headless || autosave_seconds != 0)
+        start_writer();
 }
 
 void deinit_save_states_for_rom() {
+    stop_writer();
+
     free_array_set_null(state);
-#ifdef INCLUDE_REWIND
-    free_array_set_null(rewind_buf);
-    free_array_set_null(frame_len);
-    n_recorded_frames = 0;
-#endif
+    free_array_set_null(state_file_buf);
+    free_array_set_null(compressed_file_buf);
+    free_array_set_null(decode_buf);
+    free_array_set_null(run_ahead_state);
+    free_array_set_null(run_ahead_dirty);
+    free_array_set_null(state_filename);
+    free_array_set_null(autosave_filename);
+    free_rewind_buffers();
     has_save = false;
 }
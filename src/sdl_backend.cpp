@@ -3,7 +3,9 @@
 
 #include "audio.h"
 #include "cpu.h"
+#include "headless.h"
 #include "input.h"
+#include "metrics.h"
 #ifdef RECORD_MOVIE
 #  include "movie.h"
 #endif
@@ -12,6 +14,7 @@
 #ifdef RUN_TESTS
 #  include "test.h"
 #endif
+#include "timing.h"
 
 #include "dbg.h"
 #include "dbgfont.xpm"
@@ -24,10 +27,6 @@
 // Video
 //
 
-#define NES_PPU_W 282 //including the padding
-#define NES_PPU_H 240
-#define NES_PPU_OFFSET 15
-
 #define SCREENW 320
 #define SCREENH 240
 
@@ -65,22 +64,39 @@ SDL_Rect boxify() {
 // removed but render calls when the translucent Ubuntu menu is open, and often
 // less than 60 with Firefox open too). This in turn slows down emulation and
 // messes up audio. To get around it, we upload frames in the SDL thread and
-// keep a back buffer for drawing into from the emulation thread while the
-// frame is being uploaded (a kind of manual triple buffering). If the frame
-// doesn't upload in time for the next frame, we drop the new frame. This gives
-// us automatic frame skipping in general.
+// triple buffer them:
+//
+//  - The emulation thread draws into the back buffer.
+//  - The SDL thread uploads from the front buffer.
+//  - The third buffer, in 'middle_buffer', holds the most recently completed
+//    frame.
+//
+// Handing over a buffer is an atomic exchange with 'middle_buffer', so neither
+// thread ever waits for the other. If the SDL thread falls behind, the
+// emulation thread overwrites the frame it hasn't gotten around to yet, which
+// gives automatic frame skipping without slowing down emulation.
 //
 // TODO: This could probably be optimized to eliminate some copying and format
 // conversions.
 
 
-static Uint32 *front_buffer;
-static Uint32 *back_buffer;
+static Uint32 render_buffers[3][NES_PPU_H*NES_PPU_W];
+// Index of the buffer in the middle, ORed with new_frame_bit if it holds a
+// frame the SDL thread hasn't picked up yet. Only accessed atomically.
+static unsigned middle_buffer = 2;
+unsigned const new_frame_bit = 4;
+// Only accessed from the emulation thread and the SDL thread, respectively
+static Uint32 *back_buffer  = render_buffers[0];
+static Uint32 *front_buffer = render_buffers[1];
 
-static SDL_mutex *frame_lock;
-static SDL_cond  *frame_available_cond;
-static bool ready_to_draw_new_frame;
-static bool frame_available;
+// Posted by the emulation thread when a frame has been completed, and when the
+// SDL thread should exit. The SDL thread sleeps on it between frames. Unlike
+// signaling a condition variable, posting never waits on the SDL thread.
+static SDL_sem *frame_sem;
+
+static unsigned buffer_index(Uint32 const *buffer) {
+  return (buffer - render_buffers[0])/(NES_PPU_H*NES_PPU_W);
+}
 
 bool show_debugger;
 
@@ -208,25 +224,38 @@ void put_pixel(int x, unsigned y, uint32_t color) {
   back_buffer[NES_PPU_W*y + (x + NES_PPU_OFFSET)] = color;
 }
 
+void put_pixels(int x, unsigned y, uint32_t const *colors, unsigned n) {
+  assert(x >= -NES_PPU_OFFSET);
+  assert(x + n <= (unsigned)(NES_PPU_W - NES_PPU_OFFSET));
+  assert(y < NES_PPU_H);
+
+  memcpy(back_buffer + NES_PPU_W*y + (x + NES_PPU_OFFSET), colors, sizeof(uint32_t)*n);
+}
+
 void draw_frame() {
 #ifdef RECORD_MOVIE
   add_movie_video_frame(back_buffer);
 #endif
 
-  // Signal to the SDL thread that the frame has ended
-
-  SDL_LockMutex(frame_lock);
-  // Drop the new frame if the old one is still being rendered. This also
-  // means that we drop event processing for one frame, but it's probably not
-  // a huge deal.
-  if (ready_to_draw_new_frame) {
-    frame_available = true;
-    swap(back_buffer, front_buffer);
-    SDL_CondSignal(frame_available_cond);
-  } else {
-    printf("dropping frame\n");
+  // Publish the frame and take the old middle buffer (possibly holding a frame
+  // that was never shown) as the new back buffer
+  unsigned const prev_middle =
+    __atomic_exchange_n(&middle_buffer, buffer_index(back_buffer) | new_frame_bit, __ATOMIC_ACQ_REL);
+  back_buffer = render_buffers[prev_middle & ~new_frame_bit];
+
+  // No SDL thread in headless mode. The frame stays in the middle buffer.
+  if (!headless) {
+    // The SDL thread never got to the frame we just took back
+    if (prev_middle & new_frame_bit)
+      count_metric(COUNTER_DROPPED_FRAMES);
+    SDL_SemPost(frame_sem);
   }
-  SDL_UnlockMutex(frame_lock);
+}
+
+// Only used in headless mode, where nothing takes frames from the middle
+// buffer
+uint32_t const *completed_frame() {
+  return render_buffers[__atomic_load_n(&middle_buffer, __ATOMIC_ACQUIRE) & ~new_frame_bit];
 }
 
 //
@@ -242,9 +271,6 @@ static void audio_callback(void*, Uint8 *stream, int len) {
   read_samples((int16_t*)stream, len/sizeof(int16_t));
 }
 
-void lock_audio() { SDL_LockAudioDevice(audio_device_id); }
-void unlock_audio() { SDL_UnlockAudioDevice(audio_device_id); }
-
 bool audio_pb = 1;
 int audio_pause(bool value) {
 
@@ -278,6 +304,10 @@ int audio_pause(bool value) {
 
   // Runs from emulation thread
   void handle_ui_keys() {
+    // No keyboard in headless mode
+    if (headless)
+      return;
+
     SDL_LockMutex(event_lock);
 
     if (keys[SDL_SCANCODE_ESCAPE]) 
@@ -295,15 +325,29 @@ int audio_pause(bool value) {
       set_debugger_vis(show_debugger);
     }
 
-    if (keys[SDL_SCANCODE_F5])
+    // Shift+F5/F8 save to and load from the save state file
+    bool const shift = keys[SDL_SCANCODE_LSHIFT] || keys[SDL_SCANCODE_RSHIFT];
+    if (shift && KEY_PRESSED(SDL_SCANCODE_F5)) {
+      // Written in the background so that the frame isn't delayed
+      if (queue_state_file_write(default_state_filename()))
+        printf("Saving state to '%s'\n", default_state_filename());
+      else
+        puts("Still writing earlier save states - try again");
+    }
+    else if (shift && KEY_PRESSED(SDL_SCANCODE_F8)) {
+      if (load_state_from_file(default_state_filename()))
+        printf("Loaded state from '%s'\n", default_state_filename());
+    }
+    else if (keys[SDL_SCANCODE_F5] && !shift)
       save_state();
-    else if (keys[SDL_SCANCODE_F8])
+    else if (keys[SDL_SCANCODE_F8] && !shift)
       load_state();
-#ifdef INCLUDE_REWIND
+    if (KEY_PRESSED(SDL_SCANCODE_F9)) {
+      set_rewind_budget_mb(rewind_budget_mb()/2); printf("Rewind budget is %u MiB\n", rewind_budget_mb()); }
+    else if (KEY_PRESSED(SDL_SCANCODE_F10)) {
+      set_rewind_budget_mb(rewind_budget_mb() ? 2*rewind_budget_mb() : 1); printf("Rewind budget is %u MiB\n", rewind_budget_mb()); }
     handle_rewind(keys[SDL_SCANCODE_BACKSPACE]);
-#endif
-    if (reset_pushed)
-      soft_reset();
+    fast_forward = keys[SDL_SCANCODE_TAB];
 
     SDL_UnlockMutex(event_lock);
     if (keys_size) memcpy(keys_lf, keys, keys_size * sizeof(Uint8));
@@ -415,7 +459,7 @@ static void process_events_sub(SDL_Event event) {
       break;
     case SDL_QUIT:
       end_emulation();
-      pending_sdl_thread_exit = true;
+      __atomic_store_n(&pending_sdl_thread_exit, true, __ATOMIC_RELEASE);
 #ifdef RUN_TESTS
       end_testing = true;
 #endif
@@ -503,18 +547,23 @@ static void draw_actual_frame(void) {
 void sdl_thread() {
   for (;;) {
 
-    // Wait for the emulation thread to signal that a frame has completed
+    // Wait for the emulation thread to signal that a frame has completed.
+    // The exit flag is checked first too, since it might have been set by
+    // this thread (SDL_QUIT) after which no more frames arrive.
 
-    SDL_LockMutex(frame_lock);
-    ready_to_draw_new_frame = true;
-    while (!frame_available && !pending_sdl_thread_exit)
-      SDL_CondWait(frame_available_cond, frame_lock);
-    if (pending_sdl_thread_exit) {
-      SDL_UnlockMutex(frame_lock);
+    if (__atomic_load_n(&pending_sdl_thread_exit, __ATOMIC_ACQUIRE))
       return;
-    }
-    frame_available = ready_to_draw_new_frame = false;
-    SDL_UnlockMutex(frame_lock);
+    SDL_SemWait(frame_sem);
+    if (__atomic_load_n(&pending_sdl_thread_exit, __ATOMIC_ACQUIRE))
+      return;
+
+    // Frames completed while we were drawing the previous one leave extra
+    // posts behind. Only the latest frame is drawn.
+    if (!(__atomic_load_n(&middle_buffer, __ATOMIC_ACQUIRE) & new_frame_bit))
+      continue;
+    unsigned const prev_middle =
+      __atomic_exchange_n(&middle_buffer, buffer_index(front_buffer), __ATOMIC_ACQ_REL);
+    front_buffer = render_buffers[prev_middle & ~new_frame_bit];
 
     // Process events and calculate controller input state (which might
     // need left+right/up+down elimination)
@@ -523,15 +572,19 @@ void sdl_thread() {
 
     // Draw the new frame
 
-    draw_actual_frame();
+    if (metrics_enabled) {
+      int64_t const present_start = metrics_clock();
+      draw_actual_frame();
+      record_metric(METRIC_PRESENT, (metrics_clock() - present_start)/1000);
+    }
+    else
+      draw_actual_frame();
   }
 }
 
 void exit_sdl_thread() {
-  SDL_LockMutex(frame_lock);
-  pending_sdl_thread_exit = true;
-  SDL_CondSignal(frame_available_cond);
-  SDL_UnlockMutex(frame_lock);
+  __atomic_store_n(&pending_sdl_thread_exit, true, __ATOMIC_RELEASE);
+  SDL_SemPost(frame_sem);
 }
 
 //
@@ -588,6 +641,12 @@ void init_sdl() {
     putchar('\n');
   }
 
+  // Used to pace frames with --sync-to-display. SDL reports 0 if the refresh
+  // rate is unknown.
+  SDL_DisplayMode display_mode;
+  if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(screen), &display_mode) == 0)
+    set_display_refresh_rate(display_mode.refresh_rate);
+
   SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY,"0");
 
   fail_if(!(screen_tex =
@@ -625,10 +684,6 @@ void init_sdl() {
 
   printf("dbg_font is %u %d %d %d\n",format, access, w, h);
 
-  static Uint32 render_buffers[2][NES_PPU_H*NES_PPU_W];
-  back_buffer  = render_buffers[0];
-  front_buffer = render_buffers[1];
-
   // Audio
 
   SDL_AudioSpec want;
@@ -664,10 +719,8 @@ void init_sdl() {
   fail_if(!(event_lock = SDL_CreateMutex()),
       "failed to create event mutex: %s", SDL_GetError());
 
-  fail_if(!(frame_lock = SDL_CreateMutex()),
-      "failed to create frame mutex: %s", SDL_GetError());
-  fail_if(!(frame_available_cond = SDL_CreateCond()),
-      "failed to create frame condition variable: %s", SDL_GetError());
+  fail_if(!(frame_sem = SDL_CreateSemaphore(0)),
+      "failed to create frame semaphore: %s", SDL_GetError());
 }
 
 void sdldbg_scroll(void) {
@@ -903,8 +956,7 @@ void deinit_sdl() {
 
   SDL_DestroyMutex(event_lock);
 
-  SDL_DestroyMutex(frame_lock);
-  SDL_DestroyCond(frame_available_cond);
+  SDL_DestroySemaphore(frame_sem);
 
   SDL_CloseAudioDevice(audio_device_id); // Prolly not needed, but play it safe
   SDL_Quit();
@@ -1,155 +1,269 @@
 #include "common.h"
 
 #include "cpu.h"
+#include "headless.h"
 #include "mapper.h"
 #include "rom.h"
 #include "sdl_backend.h"
+#include "test.h"
+
+#ifdef HEADLESS
+#  include <pthread.h>
+#  include <unistd.h>
+#endif
+
+EMU_STATE bool end_testing;
+
+// These can't be automated as easily:
+//   cpu_dummy_reads
+//   sprite_hit_tests_2005.10.05
+//   sprite_overflow_tests
+//
+// Tests that require manual inspection:
+//   dpcm_letterbox
+//   nmi_sync
+//
+// Look into these too:
+//   dmc_tests
+//
+// Null entries separate groups of tests in the output.
+static char const *const tests[] = {
+    "tests/ppu_vbl_nmi/rom_singles/01-vbl_basics.nes",
+    "tests/ppu_vbl_nmi/rom_singles/02-vbl_set_time.nes",
+    "tests/ppu_vbl_nmi/rom_singles/03-vbl_clear_time.nes",
+    "tests/ppu_vbl_nmi/rom_singles/04-nmi_control.nes",
+    "tests/ppu_vbl_nmi/rom_singles/05-nmi_timing.nes",
+    "tests/ppu_vbl_nmi/rom_singles/06-suppression.nes",
+    // TODO: Investigate. Possibly depends on analog effects.
+    //"tests/ppu_vbl_nmi/rom_singles/07-nmi_on_timing.nes",
+    "tests/ppu_vbl_nmi/rom_singles/08-nmi_off_timing.nes",
+    "tests/ppu_vbl_nmi/rom_singles/09-even_odd_frames.nes",
+    // TODO: Has tricky timing
+    //"tests/ppu_vbl_nmi/rom_singles/10-even_odd_timing.nes",
 
-bool end_testing;
+    0,
 
-static char const *filename;
+    "tests/ppu_open_bus/ppu_open_bus.nes",
 
-void report_status_and_end_test(uint8_t status, char const *msg) {
-    if (status == 0)
-        printf("%-60s OK\n", filename);
-    else
-        printf("%-60s FAILED\nvvv TEST OUTPUT START vvv\n%s\n^^^ TEST OUTPUT END ^^^\n",
-               filename, msg);
-    end_emulation();
-}
+    0,
 
-static void run_test(char const *file) {
-    filename = file;
-    load_rom(file, false);
-    run();
-    unload_rom();
-}
+    "tests/apu_test/rom_singles/1-len_ctr.nes",
+    "tests/apu_test/rom_singles/2-len_table.nes",
+    "tests/apu_test/rom_singles/3-irq_flag.nes",
+    "tests/apu_test/rom_singles/4-jitter.nes",
+    "tests/apu_test/rom_singles/5-len_timing.nes",
+    "tests/apu_test/rom_singles/6-irq_flag_timing.nes",
+    "tests/apu_test/rom_singles/7-dmc_basics.nes",
+    "tests/apu_test/rom_singles/8-dmc_rates.nes",
 
-void run_tests() {
-    // These can't be automated as easily:
-    //   cpu_dummy_reads
-    //   sprite_hit_tests_2005.10.05
-    //   sprite_overflow_tests
-    //
-    // Tests that require manual inspection:
-    //   dpcm_letterbox
-    //   nmi_sync
-    //
-    // Look into these too:
-    //   dmc_tests
-
-    // Do it like this to avoid extra newlines being printed when aborting
-    // testing
-    #define RUN_TEST(file) run_test(file); if (end_testing) goto end;
-
-    RUN_TEST("tests/ppu_vbl_nmi/rom_singles/01-vbl_basics.nes");
-    RUN_TEST("tests/ppu_vbl_nmi/rom_singles/02-vbl_set_time.nes");
-    RUN_TEST("tests/ppu_vbl_nmi/rom_singles/03-vbl_clear_time.nes");
-    RUN_TEST("tests/ppu_vbl_nmi/rom_singles/04-nmi_control.nes");
-    RUN_TEST("tests/ppu_vbl_nmi/rom_singles/05-nmi_timing.nes");
-    RUN_TEST("tests/ppu_vbl_nmi/rom_singles/06-suppression.nes");
-    // TODO: Investigate. Possibly depends on analog effects.
-    //RUN_TEST("tests/ppu_vbl_nmi/rom_singles/07-nmi_on_timing.nes");
-    RUN_TEST("tests/ppu_vbl_nmi/rom_singles/08-nmi_off_timing.nes");
-    RUN_TEST("tests/ppu_vbl_nmi/rom_singles/09-even_odd_frames.nes");
-    // TODO: Has tricky timing
-    //RUN_TEST("tests/ppu_vbl_nmi/rom_singles/10-even_odd_timing.nes");
+    0,
 
-    putchar('\n');
+    "tests/sprdma_and_dmc_dma/sprdma_and_dmc_dma.nes",
+    "tests/sprdma_and_dmc_dma/sprdma_and_dmc_dma_512.nes",
 
-    RUN_TEST("tests/ppu_open_bus/ppu_open_bus.nes");
+    0,
 
-    putchar('\n');
+    "tests/apu_reset/4015_cleared.nes",
+    "tests/apu_reset/4017_timing.nes",
+    "tests/apu_reset/4017_written.nes",
+    "tests/apu_reset/irq_flag_cleared.nes",
+    "tests/apu_reset/len_ctrs_enabled.nes",
+    "tests/apu_reset/works_immediately.nes",
 
-    RUN_TEST("tests/apu_test/rom_singles/1-len_ctr.nes");
-    RUN_TEST("tests/apu_test/rom_singles/2-len_table.nes");
-    RUN_TEST("tests/apu_test/rom_singles/3-irq_flag.nes");
-    RUN_TEST("tests/apu_test/rom_singles/4-jitter.nes");
-    RUN_TEST("tests/apu_test/rom_singles/5-len_timing.nes");
-    RUN_TEST("tests/apu_test/rom_singles/6-irq_flag_timing.nes");
-    RUN_TEST("tests/apu_test/rom_singles/7-dmc_basics.nes");
-    RUN_TEST("tests/apu_test/rom_singles/8-dmc_rates.nes");
+    0,
 
-    putchar('\n');
+    "tests/mmc3_test_2/rom_singles/1-clocking.nes",
+    "tests/mmc3_test_2/rom_singles/2-details.nes",
+    "tests/mmc3_test_2/rom_singles/3-A12_clocking.nes",
+    "tests/mmc3_test_2/rom_singles/4-scanline_timing.nes",
+    "tests/mmc3_test_2/rom_singles/5-MMC3.nes",
+    // Old-style behavior. Not yet implemented.
+    //"tests/mmc3_test_2/rom_singles/6-MMC3_alt.nes",
 
-    RUN_TEST("tests/sprdma_and_dmc_dma/sprdma_and_dmc_dma.nes");
-    RUN_TEST("tests/sprdma_and_dmc_dma/sprdma_and_dmc_dma_512.nes");
+    0,
 
-    putchar('\n');
+    "tests/oam_read/oam_read.nes",
 
-    RUN_TEST("tests/apu_reset/4015_cleared.nes");
-    RUN_TEST("tests/apu_reset/4017_timing.nes");
-    RUN_TEST("tests/apu_reset/4017_written.nes");
-    RUN_TEST("tests/apu_reset/irq_flag_cleared.nes");
-    RUN_TEST("tests/apu_reset/len_ctrs_enabled.nes");
-    RUN_TEST("tests/apu_reset/works_immediately.nes");
+    0,
 
-    putchar('\n');
+    "tests/oam_stress/oam_stress.nes",
 
-    RUN_TEST("tests/mmc3_test_2/rom_singles/1-clocking.nes");
-    RUN_TEST("tests/mmc3_test_2/rom_singles/2-details.nes");
-    RUN_TEST("tests/mmc3_test_2/rom_singles/3-A12_clocking.nes");
-    RUN_TEST("tests/mmc3_test_2/rom_singles/4-scanline_timing.nes");
-    RUN_TEST("tests/mmc3_test_2/rom_singles/5-MMC3.nes");
-    // Old-style behavior. Not yet implemented.
-    //RUN_TEST("tests/mmc3_test_2/rom_singles/6-MMC3_alt.nes");
+    0,
 
-    putchar('\n');
+    "tests/cpu_reset/ram_after_reset.nes",
+    "tests/cpu_reset/registers.nes",
 
-    RUN_TEST("tests/oam_read/oam_read.nes");
+    0,
 
-    putchar('\n');
+    "tests/instr_test-v4/rom_singles/01-basics.nes",
+    "tests/instr_test-v4/rom_singles/02-implied.nes",
+    "tests/instr_test-v4/rom_singles/03-immediate.nes",
+    "tests/instr_test-v4/rom_singles/04-zero_page.nes",
+    "tests/instr_test-v4/rom_singles/05-zp_xy.nes",
+    "tests/instr_test-v4/rom_singles/06-absolute.nes",
+    "tests/instr_test-v4/rom_singles/07-abs_xy.nes",
+    "tests/instr_test-v4/rom_singles/08-ind_x.nes",
+    "tests/instr_test-v4/rom_singles/09-ind_y.nes",
+    "tests/instr_test-v4/rom_singles/10-branches.nes",
+    "tests/instr_test-v4/rom_singles/11-stack.nes",
+    "tests/instr_test-v4/rom_singles/12-jmp_jsr.nes",
+    "tests/instr_test-v4/rom_singles/13-rts.nes",
+    "tests/instr_test-v4/rom_singles/14-rti.nes",
+    "tests/instr_test-v4/rom_singles/15-brk.nes",
+    "tests/instr_test-v4/rom_singles/16-special.nes",
 
-    RUN_TEST("tests/oam_stress/oam_stress.nes");
+    0,
 
-    putchar('\n');
+    "tests/instr_misc/rom_singles/01-abs_x_wrap.nes",
+    "tests/instr_misc/rom_singles/02-branch_wrap.nes",
+    "tests/instr_misc/rom_singles/03-dummy_reads.nes",
+    "tests/instr_misc/rom_singles/04-dummy_reads_apu.nes",
 
-    RUN_TEST("tests/cpu_reset/ram_after_reset.nes");
-    RUN_TEST("tests/cpu_reset/registers.nes");
+    0,
 
-    putchar('\n');
+    "tests/cpu_interrupts_v2/rom_singles/1-cli_latency.nes",
+    "tests/cpu_interrupts_v2/rom_singles/2-nmi_and_brk.nes",
+    "tests/cpu_interrupts_v2/rom_singles/3-nmi_and_irq.nes",
+    "tests/cpu_interrupts_v2/rom_singles/4-irq_and_dma.nes",
+    "tests/cpu_interrupts_v2/rom_singles/5-branch_delays_irq.nes",
 
-    RUN_TEST("tests/instr_test-v4/rom_singles/01-basics.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/02-implied.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/03-immediate.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/04-zero_page.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/05-zp_xy.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/06-absolute.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/07-abs_xy.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/08-ind_x.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/09-ind_y.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/10-branches.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/11-stack.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/12-jmp_jsr.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/13-rts.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/14-rti.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/15-brk.nes");
-    RUN_TEST("tests/instr_test-v4/rom_singles/16-special.nes");
+    0,
 
-    putchar('\n');
+    "tests/instr_timing/rom_singles/1-instr_timing.nes",
+    "tests/instr_timing/rom_singles/2-branch_timing.nes",
+};
 
-    RUN_TEST("tests/instr_misc/rom_singles/01-abs_x_wrap.nes");
-    RUN_TEST("tests/instr_misc/rom_singles/02-branch_wrap.nes");
-    RUN_TEST("tests/instr_misc/rom_singles/03-dummy_reads.nes");
-    RUN_TEST("tests/instr_misc/rom_singles/04-dummy_reads_apu.nes");
+unsigned const n_tests = sizeof(tests)/sizeof(*tests);
 
-    putchar('\n');
+// Number of frames a test may run for in headless mode before it's considered
+// hung
+unsigned long const test_frame_limit = 120*60;
 
-    RUN_TEST("tests/cpu_interrupts_v2/rom_singles/1-cli_latency.nes");
-    RUN_TEST("tests/cpu_interrupts_v2/rom_singles/2-nmi_and_brk.nes");
-    RUN_TEST("tests/cpu_interrupts_v2/rom_singles/3-nmi_and_irq.nes");
-    RUN_TEST("tests/cpu_interrupts_v2/rom_singles/4-irq_and_dma.nes");
-    RUN_TEST("tests/cpu_interrupts_v2/rom_singles/5-branch_delays_irq.nes");
+static struct Test_result {
+    // True if the test reported a status. False if it timed out or testing
+    // was aborted.
+    bool reported;
+    uint8_t status;
+    // Text output from the test. Dynamically allocated.
+    char *msg;
+} results[n_tests];
 
-    putchar('\n');
+// Result of the test running on this thread
+static EMU_STATE Test_result *result;
 
-    RUN_TEST("tests/instr_timing/rom_singles/1-instr_timing.nes");
-    RUN_TEST("tests/instr_timing/rom_singles/2-branch_timing.nes");
+void report_status_and_end_test(uint8_t status, char const *msg) {
+    result->reported = true;
+    result->status   = status;
+    fail_if(!(result->msg = new (std::nothrow) char[strlen(msg) + 1]),
+            "failed to allocate memory for test output");
+    strcpy(result->msg, msg);
+    end_emulation();
+}
+
+static void run_test(unsigned i) {
+    result = &results[i];
+    headless_frames_run = 0;
+    headless_frame_limit = test_frame_limit;
+    load_rom(tests[i], false);
+    run();
+    unload_rom();
+}
 
-    putchar('\n');
+// Prints the result of test 'i'. Returns true if it passed.
+static bool print_result(unsigned i) {
+    Test_result const &r = results[i];
 
-    #undef RUN_TEST
+    if (!r.reported) {
+        printf("%-60s FAILED (no result after %lu frames)\n", tests[i], test_frame_limit);
+        return false;
+    }
+    if (r.status != 0) {
+        printf("%-60s FAILED\nvvv TEST OUTPUT START vvv\n%s\n^^^ TEST OUTPUT END ^^^\n",
+               tests[i], r.msg);
+        return false;
+    }
+    printf("%-60s OK\n", tests[i]);
+    return true;
+}
+
+#ifdef HEADLESS
+
+// Index of the next test for a worker to run
+static unsigned next_test;
+
+// Since all emulation state is thread-local in HEADLESS=1 builds (see
+// EMU_STATE in common.h), each worker can run a test independently of the
+// others
+static void *test_worker(void*) {
+    for (;;) {
+        unsigned const i = __sync_fetch_and_add(&next_test, 1);
+        if (i >= n_tests)
+            return 0;
+        if (tests[i])
+            run_test(i);
+    }
+}
+
+// Runs the tests on one worker thread per core. Results are printed in list
+// order once all tests have finished.
+static void run_tests_in_parallel() {
+    long const n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned const n_workers = n_cpus < 1 ? 1 : min((unsigned)n_cpus, n_tests);
+    pthread_t *const workers = new pthread_t[n_workers];
+
+    for (unsigned i = 0; i < n_workers; ++i) {
+        int const res = pthread_create(&workers[i], 0, test_worker, 0);
+        errno_val_fail_if(res != 0, res, "failed to create test worker thread");
+    }
+    for (unsigned i = 0; i < n_workers; ++i) {
+        int const res = pthread_join(workers[i], 0);
+        errno_val_fail_if(res != 0, res, "failed to join test worker thread");
+    }
+
+    delete [] workers;
+}
 
-end:
-    exit_sdl_thread();
+#endif
+
+bool run_tests() {
+    timespec start;
+    errno_fail_if(clock_gettime(CLOCK_MONOTONIC, &start) == -1,
+                  "failed to get start time from clock_gettime()");
+
+#ifdef HEADLESS
+    run_tests_in_parallel();
+#endif
+
+    unsigned n_run = 0, n_failed = 0;
+    for (unsigned i = 0; i < n_tests; ++i) {
+        if (!tests[i]) {
+            putchar('\n');
+            continue;
+        }
+
+#ifndef HEADLESS
+        // Emulation state is shared, so run the tests one at a time. Printing
+        // the results as we go shows progress.
+        run_test(i);
+        // Avoid printing a result when testing is aborted by closing the
+        // window
+        if (end_testing)
+            break;
+#endif
+        ++n_run;
+        if (!print_result(i))
+            ++n_failed;
+        free_array_set_null(results[i].msg);
+    }
+
+    timespec end;
+    errno_fail_if(clock_gettime(CLOCK_MONOTONIC, &end) == -1,
+                  "failed to get end time from clock_gettime()");
+    printf("%u of %u tests passed in %.1f s\n", n_run - n_failed, n_run,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9);
+
+    if (!headless)
+        exit_sdl_thread();
+
+    return n_failed == 0 && !end_testing;
 }
@@ -1,12 +1,18 @@
 #include "common.h"
 
 #include "mapper.h"
+#include "metrics.h"
 #include "rom.h"
 #include "timing.h"
 
-double cpu_clock_rate;
-double ppu_clock_rate;
-double ppu_fps;
+#include <cmath>
+
+EMU_STATE double cpu_clock_rate;
+EMU_STATE double ppu_clock_rate;
+EMU_STATE double ppu_fps;
+
+EMU_STATE bool fast_forward;
+EMU_STATE unsigned fast_forward_speed;
 
 void init_timing_for_rom() {
     if (is_pal) {
@@ -23,32 +29,192 @@ void init_timing_for_rom() {
     }
 }
 
-// TODO: Use SDL_Delay() instead? Higher sleep precision is good for audio
-// buffer management, but that needs to be quantified, and whether
-// clock_nanosleep() gives a noticeable precision improvement depends on OS
-// scheduling.
+// Frames are paced against an absolute schedule. The deadline for frame n after
+// the start of the schedule is start + n*period, independent of when we
+// actually woke up for earlier frames, so oversleeping doesn't accumulate into
+// drift. If we fall more than max_frames_behind frames behind (e.g. after
+// emulation has been paused in the debugger), the schedule restarts from the
+// current time rather than running frames back-to-back to catch up.
+//
+// Waiting is done in two steps: clock_nanosleep() until spin_margin before the
+// deadline, followed by spinning on clock_gettime() for the rest. The margin
+// tracks how much the sleeps overshoot, which depends on OS scheduling.
+
+unsigned const max_frames_behind = 3;
+
+// Bounds for spin_margin, in nanoseconds. Spinning longer than the maximum
+// would waste too much CPU time to be worth it.
+int64_t const min_spin_margin = 250000;
+int64_t const max_spin_margin = 2000000;
+
+// The display refresh rate is only used if it's within this fraction of the
+// emulated frame rate. The audio code adjusts the playback rate to keep its
+// buffer filled, which covers the difference (see max_adjust in audio.cpp).
+double const max_display_rate_diff = 0.01;
+
+EMU_STATE bool sync_to_display;
+EMU_STATE Frame_pacing_stats frame_pacing_stats;
 
-// Used for main loop synchronization
-static timespec clock_previous;
+// Reported by the SDL backend. 0 if unknown.
+static double display_refresh_rate;
 
-static void add_to_timespec(timespec &ts, long nano_secs) {
-    long const new_nanos = ts.tv_nsec + nano_secs;
-    ts.tv_sec += new_nanos/1000000000l;
-    ts.tv_nsec = new_nanos%1000000000l;
+// Frames per second that frames are paced at. Either ppu_fps or the display
+// refresh rate.
+static EMU_STATE double paced_fps;
+
+// The schedule. Times are in nanoseconds from clock_gettime(CLOCK_MONOTONIC).
+static EMU_STATE int64_t schedule_start;
+static EMU_STATE double schedule_period;
+static EMU_STATE unsigned long schedule_frames;
+
+static EMU_STATE int64_t spin_margin;
+// Exponential moving average of how much clock_nanosleep() oversleeps
+static EMU_STATE double avg_oversleep;
+
+// Time at which the previous frame ended, i.e. when sleep_till_end_of_frame()
+// last returned
+static EMU_STATE int64_t frame_end;
+
+static int64_t now_nanos() {
+    timespec ts;
+    errno_fail_if(clock_gettime(CLOCK_MONOTONIC, &ts) == -1,
+      "failed to fetch synchronization timestamp from clock_gettime()");
+    return 1000000000ll*ts.tv_sec + ts.tv_nsec;
+}
+
+static void restart_schedule(int64_t start, double period) {
+    schedule_start  = start;
+    schedule_period = period;
+    schedule_frames = 0;
+}
+
+void set_display_refresh_rate(double hz) {
+    display_refresh_rate = hz;
 }
 
 void init_timing() {
-    errno_fail_if(clock_gettime(CLOCK_MONOTONIC, &clock_previous) == -1,
-      "failed to fetch initial synchronization timestamp from clock_gettime()");
+    paced_fps = ppu_fps;
+    if (sync_to_display) {
+        if (display_refresh_rate == 0)
+            puts("The display refresh rate is unknown. Pacing frames at the emulated frame rate.");
+        else if (fabs(display_refresh_rate/ppu_fps - 1) > max_display_rate_diff)
+            printf("The display refresh rate (%.2f Hz) is too far from the emulated frame "
+                   "rate (%.2f FPS) to sync to\n", display_refresh_rate, ppu_fps);
+        else {
+            paced_fps = display_refresh_rate;
+            printf("Pacing frames at the display refresh rate (%.2f Hz)\n", paced_fps);
+        }
+    }
+
+    frame_end = now_nanos();
+    restart_schedule(frame_end, 1e9/paced_fps);
+    spin_margin   = max_spin_margin;
+    avg_oversleep = max_spin_margin/2;
+    frame_pacing_stats = Frame_pacing_stats();
 }
 
+// Sleeps and then spins until 'deadline'
+static void wait_until(int64_t deadline) {
+    int64_t const sleep_end = deadline - spin_margin;
+    if (now_nanos() < sleep_end) {
+        timespec const ts = { time_t(sleep_end/1000000000), long(sleep_end%1000000000) };
+    again:
+        int const res = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0);
+        if (res == EINTR) goto again;
+        errno_val_fail_if(res != 0, res, "failed to sleep with clock_nanosleep()");
+
+        // Keep the margin at about twice the typical oversleep
+        avg_oversleep = 0.9*avg_oversleep + 0.1*(now_nanos() - sleep_end);
+        spin_margin = min(max(int64_t(2*avg_oversleep), min_spin_margin), max_spin_margin);
+    }
+
+    while (now_nanos() < deadline);
+}
+
+static void update_stats(int64_t deadline, int64_t interval) {
+    Frame_pacing_stats &s = frame_pacing_stats;
+
+    ++s.frames;
+    double const interval_secs = interval/1e9;
+    s.interval_sum    += interval_secs;
+    s.interval_sum_sq += interval_secs*interval_secs;
+    s.interval_max     = max(s.interval_max, interval_secs);
+    double const lateness_secs = (frame_end - deadline)/1e9;
+    s.lateness_sum += lateness_secs;
+    s.lateness_max  = max(s.lateness_max, lateness_secs);
+}
+
+// Length of the frame that just ended, and the time the last shown frame
+// ended. Used to decide which frames to skip while fast-forwarding.
+static EMU_STATE int64_t prev_frame_len;
+static EMU_STATE int64_t last_shown;
+// True if the frame being run was picked to be skipped
+static EMU_STATE bool skipping_frame;
+
 void sleep_till_end_of_frame() {
-    add_to_timespec(clock_previous, 1e9/ppu_fps);
-again:
-    int const res =
-      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &clock_previous, 0);
-    if (res == EINTR) goto again;
-    errno_val_fail_if(res != 0, res, "failed to sleep with clock_nanosleep()");
-    errno_fail_if(clock_gettime(CLOCK_MONOTONIC, &clock_previous) == -1,
-      "failed to fetch synchronization timestamp from clock_gettime()");
+    int64_t const prev_frame_end = frame_end;
+
+    if (fast_forward && fast_forward_speed == 0) {
+        // As fast as possible. The schedule restarts from the last frame
+        // when fast-forwarding ends.
+        frame_end = now_nanos();
+        restart_schedule(frame_end, 0);
+        prev_frame_len = frame_end - prev_frame_end;
+        return;
+    }
+
+    double const period = fast_forward ? 1e9/(fast_forward_speed*paced_fps) : 1e9/paced_fps;
+    if (period != schedule_period)
+        // Started or stopped fast-forwarding. Start over from the last
+        // frame's deadline (or end, after running unthrottled).
+        restart_schedule(schedule_period == 0 ? frame_end :
+                           schedule_start + int64_t(schedule_frames*schedule_period),
+                         period);
+
+    int64_t deadline = schedule_start + int64_t(++schedule_frames*period);
+    int64_t const now = now_nanos();
+    if (now > deadline + max_frames_behind*period) {
+        if (!fast_forward)
+            ++frame_pacing_stats.resyncs;
+        restart_schedule(now, period);
+        deadline = now;
+    }
+    else if (now < deadline) {
+        wait_until(deadline);
+        record_sleep_time(now_nanos() - now);
+    }
+    else if (!fast_forward)
+        ++frame_pacing_stats.late_frames;
+
+    frame_end = now_nanos();
+    prev_frame_len = frame_end - prev_frame_end;
+    if (!fast_forward)
+        update_stats(deadline, prev_frame_len);
+}
+
+bool skip_next_frame() {
+    if (!skipping_frame)
+        last_shown = frame_end;
+
+    // Show a frame if it will end at least a normal frame's length after the
+    // last one shown, assuming it takes as long to run as the previous frame.
+    // Showing more would only make the SDL thread drop them.
+    skipping_frame = fast_forward && frame_end + prev_frame_len - last_shown < 1e9/paced_fps;
+    return skipping_frame;
+}
+
+void print_frame_pacing_stats() {
+    Frame_pacing_stats const &s = frame_pacing_stats;
+    if (s.frames == 0) {
+        puts("Frame pacing: no frames paced");
+        return;
+    }
+
+    double const mean = s.interval_sum/s.frames;
+    double const var  = max(s.interval_sum_sq/s.frames - mean*mean, 0.0);
+    printf("Frame pacing: %lu frames at %.3f FPS, frame time %.3f ms mean, %.3f ms "
+           "std dev, %.3f ms max; %.3f ms mean and %.3f ms max past the deadline; "
+           "%lu late, %lu resyncs\n",
+           s.frames, paced_fps, 1e3*mean, 1e3*sqrt(var), 1e3*s.interval_max,
+           1e3*s.lateness_sum/s.frames, 1e3*s.lateness_max, s.late_frames, s.resyncs);
 }
@@ -0,0 +1,72 @@
+#!/bin/sh
+# Compares the speed of the switch-based and threaded instruction dispatch in
+# the CPU core (see THREADED_DISPATCH in the Makefile).
+#
+# Builds both variants with HEADLESS=1 into build-dispatch-switch/ and
+# build-dispatch-threaded/, runs each ROM headless for <frames> frames (default
+# 3000) with both, and prints the instructions executed per second of CPU time
+# along with the gain of threaded dispatch. Each measurement is the best of
+# <runs> runs (default 3).
+
+set -e
+
+usage() {
+    echo "usage: $0 [-f <frames>] [-r <runs>] <rom file> [<rom file> ...]" >&2
+    exit 1
+}
+
+frames=3000
+runs=3
+while getopts f:r: opt; do
+    case $opt in
+    f) frames=$OPTARG ;;
+    r) runs=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+[ $# -ge 1 ] || usage
+
+root=$(dirname "$0")/..
+
+for variant in switch threaded; do
+    if [ $variant = threaded ]; then threaded=1; else threaded=0; fi
+    echo "Building $variant dispatch..."
+    if ! log=$(make -C "$root" -j4 HEADLESS=1 THREADED_DISPATCH=$threaded \
+                 BUILD_DIR=build-dispatch-$variant 2>&1); then
+        echo "$log" >&2
+        exit 1
+    fi
+done
+
+# Prints the best instructions/s figure for ROM $2 with variant $1. Exits with
+# an error if the emulator fails or its summary can't be parsed. (It's run in
+# a command substitution, so 'set -e' makes the caller exit too.)
+measure() {
+    best=0
+    i=0
+    while [ $i -lt $runs ]; do
+        if ! out=$("$root/build-dispatch-$1/nesalizer" --frames $frames "$2" 2>&1); then
+            echo "$out" >&2
+            echo "$0: the $1 dispatch build failed on '$2'" >&2
+            exit 1
+        fi
+        ips=$(echo "$out" | sed -n 's/.*(\([0-9]*\) instructions\/s)$/\1/p')
+        if [ -z "$ips" ]; then
+            echo "$out" >&2
+            echo "$0: no instructions/s figure in the output of the $1 dispatch build on '$2'" >&2
+            exit 1
+        fi
+        [ "$ips" -gt $best ] && best=$ips
+        i=$((i + 1))
+    done
+    echo $best
+}
+
+printf "%-32s %16s %16s %8s\n" ROM "switch instr/s" "threaded instr/s" gain
+for rom in "$@"; do
+    switch=$(measure switch "$rom")
+    threaded=$(measure threaded "$rom")
+    printf "%-32s %16s %16s %+7.1f%%\n" "$(basename "$rom")" $switch $threaded \
+      "$(echo "$switch $threaded" | awk '{ print 100*($2 - $1)/$1 }')"
+done
@@ -0,0 +1,88 @@
+#!/bin/sh
+# Checks that the emulator's video and audio output hasn't changed, by
+# comparing frame hashes (see --frame-hashes) against golden files.
+#
+# The suite file lists one run per line:
+#
+#   <name> <rom file> <input log, or - for none> <frames>
+#
+# Blank lines and lines starting with '#' are ignored. Paths are relative to
+# the directory of the suite file, and the golden hashes for each run are kept
+# in golden/<name>.hashes next to it. Runs are made with a HEADLESS=1 build in
+# build-frame-hashes/, hashing every <interval>th frame (default 60). With -u,
+# the golden files are written instead of checked, e.g. to create them before
+# starting on an optimization that shouldn't change the output.
+#
+# Exits with status 1 if any run doesn't match.
+
+set -e
+
+usage() {
+    echo "usage: $0 [-u] [-i <interval>] <suite file>" >&2
+    exit 1
+}
+
+update=0
+interval=60
+while getopts ui: opt; do
+    case $opt in
+    u) update=1 ;;
+    i) interval=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+[ $# -eq 1 ] || usage
+
+root=$(dirname "$0")/..
+suite_dir=$(dirname "$1")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+echo "Building..."
+if ! log=$(make -C "$root" -j4 HEADLESS=1 BUILD_DIR=build-frame-hashes 2>&1); then
+    echo "$log" >&2
+    exit 1
+fi
+mkdir -p "$suite_dir/golden"
+
+failed=0
+while read -r name rom input frames; do
+    case $name in
+    ''|'#'*) continue ;;
+    esac
+
+    if [ "$input" = - ]; then
+        set -- --frames "$frames"
+    else
+        set -- --frames "$frames" --play-input "$suite_dir/$input"
+    fi
+    hashes=$tmp/$name.hashes
+    if ! "$root/build-frame-hashes/nesalizer" "$@" --frame-hashes "$hashes" \
+           --hash-interval $interval "$suite_dir/$rom" </dev/null >"$tmp/$name.log" 2>&1; then
+        printf "%-32s FAILED (emulator exited with an error)\n" "$name"
+        cat "$tmp/$name.log"
+        failed=1
+        continue
+    fi
+
+    golden=$suite_dir/golden/$name.hashes
+    if [ $update -eq 1 ]; then
+        cp "$hashes" "$golden"
+        printf "%-32s updated\n" "$name"
+    elif [ ! -f "$golden" ]; then
+        printf "%-32s FAILED (no golden file; create it with -u)\n" "$name"
+        failed=1
+    elif cmp -s "$hashes" "$golden"; then
+        printf "%-32s OK\n" "$name"
+    else
+        # The first line that differs gives the first frame that differs, to
+        # within the interval
+        frame=$(awk 'NR == FNR { golden[FNR] = $0; next }
+                     golden[FNR] != $0 { print $1; exit }' "$golden" "$hashes")
+        printf "%-32s FAILED (output differs by frame %s)\n" "$name" "${frame:-?}"
+        failed=1
+    fi
+done < "$1"
+
+exit $failed